@@ -24,6 +24,7 @@
 
 #include "SoapyLoopbackRx.hpp"
 #include "SoapyLoopbackTx.hpp"
+#include "SoapyLoopbackTrx.hpp"
 #include <SoapySDR/Registry.hpp>
 #include "config.h"
 
@@ -66,6 +67,21 @@ static std::vector<SoapySDR::Kwargs> findRx(const SoapySDR::Kwargs &args)
     return results;
 }
 
+static std::vector<SoapySDR::Kwargs> findTrx(const SoapySDR::Kwargs &args)
+{
+    std::vector<SoapySDR::Kwargs> results;
+
+    SoapySDR::Kwargs devInfo;
+
+    devInfo["label"] = "loopback_Trx";
+    devInfo["product"] = "loopback_Trx";
+    devInfo["serial"] = "0000-0000";
+    devInfo["manufacturer"] = "drAK";
+
+    results.push_back(devInfo);
+
+    return results;
+}
 
 static SoapySDR::Device *makeTx(const SoapySDR::Kwargs &args)
 {
@@ -77,5 +93,11 @@ static SoapySDR::Device *makeRx(const SoapySDR::Kwargs &args)
     return new SoapyLoopbackRx(args);
 }
 
+static SoapySDR::Device *makeTrx(const SoapySDR::Kwargs &args)
+{
+    return new SoapyLoopbackTrx(args);
+}
+
 static SoapySDR::Registry registerLoopbackTx("drAK_loopbackTx", &findTx, &makeTx, SOAPY_SDR_ABI_VERSION);
 static SoapySDR::Registry registerLoopbackRx("drAK_loopbackRx", &findRx, &makeRx, SOAPY_SDR_ABI_VERSION);
+static SoapySDR::Registry registerLoopbackTrx("drAK_loopbackTrx", &findTrx, &makeTrx, SOAPY_SDR_ABI_VERSION);
@@ -26,15 +26,19 @@
 #include "SoapyLoopback.hpp"
 #include <SoapySDR/Time.hpp>
 #include <algorithm>
-
+#include <fmt/core.h>
+
+#include "SoapyLoopbackMedium.hpp"
+#include "SoapyLoopbackNullSink.hpp"
+#include "SoapyLoopbackScenario.hpp"
+#include "SoapyLoopbackSpectrum.hpp"
+#include "SoapyLoopbackTrace.hpp"
+#include "SoapyLoopbackWorkers.hpp"
 #include "config.h"
 
 SoapyLoopback::SoapyLoopback(const SoapySDR::Kwargs &args):
     _ref_source("internal"),
     time_source("sw_ticks"),
-    sampleRate(2048000),
-    centerFrequency(100000000),
-    bandwidth(0),
     ppm(0),
     directSamplingMode(0),
     numBuffers(DEFAULT_NUM_BUFFERS),
@@ -43,11 +47,18 @@ SoapyLoopback::SoapyLoopback(const SoapySDR::Kwargs &args):
     gainMode(false),
     offsetMode(false),
     digitalAGC(false),
-    ticks(false),
+    timeNs(0),
+    simTime(false),
     gainMin(0.0),
-    gainMax(0.0)
+    gainMax(0.0),
+    dspThreads(0),
+    spectrumSize(SpectrumMonitor::DEFAULT_SIZE),
+    dcOffsetMode(false),
+    poolMemory(PoolMemory::fromArgs(args, PoolMemory())),
+    scenarioVersion(0)
 {
-
+    if (args.count("time_source") > 0)
+        setTimeSource(args.at("time_source"));
 }
 
 SoapyLoopback::~SoapyLoopback(void)
@@ -90,7 +101,20 @@ bool SoapyLoopback::getFullDuplex(const int direction, const size_t channel) con
 
 bool SoapyLoopback::hasDCOffsetMode(const int direction, const size_t channel) const
 {
-    return false;
+    //readStream estimates the DC of the received samples and removes it
+    return direction == SOAPY_SDR_RX;
+}
+
+void SoapyLoopback::setDCOffsetMode(const int direction, const size_t channel, const bool automatic)
+{
+    if (direction != SOAPY_SDR_RX)
+        return;
+    dcOffsetMode = automatic;
+}
+
+bool SoapyLoopback::getDCOffsetMode(const int direction, const size_t channel) const
+{
+    return direction == SOAPY_SDR_RX && dcOffsetMode;
 }
 
 bool SoapyLoopback::hasFrequencyCorrection(const int direction, const size_t channel) const
@@ -235,7 +259,8 @@ void SoapyLoopback::setFrequency(
 {
     if (name == "RF")
     {
-        centerFrequency = frequency;
+        tuningOf(direction).centerFrequency = frequency;
+        retuneMedium(direction);
     } else if (name == "CORR")
     {
         ppm = frequency;
@@ -249,7 +274,7 @@ double SoapyLoopback::getFrequency(const int direction, const size_t channel, co
 {
     if (name == "RF")
     {
-        return (double) centerFrequency;
+        return tuningOf(direction).centerFrequency;
     } else if (name == "CORR")
     {
         return ppm;
@@ -297,15 +322,15 @@ SoapySDR::ArgInfoList SoapyLoopback::getFrequencyArgsInfo(const int direction, c
 
 void SoapyLoopback::setSampleRate(const int direction, const size_t channel, const double rate)
 {
-    long long ns = SoapySDR::ticksToTimeNs(ticks, sampleRate);
-    sampleRate = rate;
-    SoapySDR_logf(SOAPY_SDR_DEBUG, "Setting sample rate: %d", sampleRate);
-    ticks = SoapySDR::timeNsToTicks(ns, sampleRate);
+    // the hardware time is kept in ns, a new rate only changes how ticks map onto it
+    tuningOf(direction).sampleRate = rate;
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "Setting %s sample rate: %g", direction == SOAPY_SDR_TX ? "Tx" : "Rx", rate);
+    retuneMedium(direction);
 }
 
 double SoapyLoopback::getSampleRate(const int direction, const size_t channel) const
 {
-    return sampleRate;
+    return tuningOf(direction).sampleRate;
 }
 
 std::vector<double> SoapyLoopback::listSampleRates(const int direction, const size_t channel) const
@@ -334,14 +359,28 @@ SoapySDR::RangeList SoapyLoopback::getSampleRateRange(const int direction, const
 
 void SoapyLoopback::setBandwidth(const int direction, const size_t channel, const double bw)
 {
-    bandwidth = bw;
+    tuningOf(direction).bandwidth = bw;
+    retuneMedium(direction);
 }
 
 double SoapyLoopback::getBandwidth(const int direction, const size_t channel) const
 {
-    if (bandwidth == 0) // auto / full bandwidth
-        return sampleRate;
-    return bandwidth;
+    const Tuning &dir = tuningOf(direction);
+    const double bw = dir.bandwidth;
+    if (bw == 0) // auto / full bandwidth
+        return dir.sampleRate;
+    return bw;
+}
+
+void SoapyLoopback::retuneMedium(const int direction)
+{
+    const Tuning &dir = tuningOf(direction);
+    std::unique_lock lock(streamsMutex);
+    for (const auto &stream : streams)
+    {
+        if (stream->mediumPort && stream->direction == direction)
+            stream->mediumPort->tune(dir.centerFrequency, dir.sampleRate, getBandwidth(direction, 0));
+    }
 }
 
 std::vector<double> SoapyLoopback::listBandwidths(const int direction, const size_t channel) const
@@ -371,6 +410,7 @@ std::vector<std::string> SoapyLoopback::listTimeSources(void) const
 
     results.push_back("sw_ticks");
     results.push_back("hw_ticks");
+    results.push_back("sim");
 
     return results;
 }
@@ -383,21 +423,42 @@ std::string SoapyLoopback::getTimeSource(void) const
 void SoapyLoopback::setTimeSource(const std::string &what)
 {
     time_source = what;
+    simTime = (what == "sim");
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "Loopback time source %s, simulated time %s", what.c_str(), simTime ? "on" : "off");
 }
 
 bool SoapyLoopback::hasHardwareTime(const std::string &what) const
 {
-    return what == "" || what == "sw_ticks";
+    return what == "" || what == "sw_ticks" || what == "sim";
 }
 
 long long SoapyLoopback::getHardwareTime(const std::string &what) const
 {
-    return SoapySDR::ticksToTimeNs(ticks, sampleRate);
+    return timeNs;
 }
 
 void SoapyLoopback::setHardwareTime(const long long timeNs, const std::string &what)
 {
-    ticks = SoapySDR::timeNsToTicks(timeNs, sampleRate);
+    this->timeNs = timeNs;
+}
+
+long long SoapyLoopback::currentTicks(const int direction) const
+{
+    return SoapySDR::timeNsToTicks(timeNs, tuningOf(direction).sampleRate);
+}
+
+void SoapyLoopback::advanceTicks(const int direction, const long long tick)
+{
+    const long long ns = SoapySDR::ticksToTimeNs(tick, tuningOf(direction).sampleRate);
+    long long current = timeNs.load(std::memory_order_relaxed);
+    while (current < ns && !timeNs.compare_exchange_weak(current, ns, std::memory_order_relaxed))
+        ;
+}
+
+std::chrono::microseconds SoapyLoopback::pipeTimeout(const long timeoutUs) const
+{
+    // in simulated time progress only depends on the samples, a slow machine must not time out
+    return simTime ? Connector::UNTIMED : std::chrono::microseconds(timeoutUs);
 }
 
 /*******************************************************************
@@ -448,11 +509,84 @@ SoapySDR::ArgInfoList SoapyLoopback::getSettingInfo(void) const
     digitalAGCArg.key = "digital_agc";
     digitalAGCArg.value = "false";
     digitalAGCArg.name = "Digital AGC";
-    digitalAGCArg.description = "digital AGC Mode";
+    digitalAGCArg.description = "Rx streams scale their samples so the power settles at -12 dBFS";
     digitalAGCArg.type = SoapySDR::ArgInfo::BOOL;
 
     setArgs.push_back(digitalAGCArg);
 
+    SoapySDR::ArgInfo traceArg;
+
+    traceArg.key = "trace";
+    traceArg.value = "false";
+    traceArg.name = "Trace";
+    traceArg.description = "Record hot path trace events (requires a build with ENABLE_TRACE)";
+    traceArg.type = SoapySDR::ArgInfo::BOOL;
+
+    setArgs.push_back(traceArg);
+
+    SoapySDR::ArgInfo traceDumpArg;
+
+    traceDumpArg.key = "trace_dump";
+    traceDumpArg.value = "";
+    traceDumpArg.name = "Trace dump";
+    traceDumpArg.description = "Write the recorded trace events as Chrome trace JSON to the given path";
+    traceDumpArg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(traceDumpArg);
+
+    SoapySDR::ArgInfo statsResetArg;
+
+    statsResetArg.key = "stats_reset";
+    statsResetArg.value = "";
+    statsResetArg.name = "Reset statistics";
+    statsResetArg.description = "Clear the pipe telemetry counters, the pipe metrics are readable as settings with the sensor names";
+    statsResetArg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(statsResetArg);
+
+    SoapySDR::ArgInfo dspThreadsArg;
+
+    dspThreadsArg.key = "dsp_threads";
+    dspThreadsArg.value = "0";
+    dspThreadsArg.name = "DSP workers";
+    dspThreadsArg.description = "Number of module wide worker threads processing the frames of dsp_pool=true streams, 0 for one per hardware thread minus one";
+    dspThreadsArg.type = SoapySDR::ArgInfo::INT;
+
+    setArgs.push_back(dspThreadsArg);
+
+    SoapySDR::ArgInfo dspAffinityArg;
+
+    dspAffinityArg.key = "dsp_affinity";
+    dspAffinityArg.value = "";
+    dspAffinityArg.name = "DSP worker affinity";
+    dspAffinityArg.description = "CPU list for the DSP workers, e.g. 2-5, worker i is pinned to the i-th CPU of the list";
+    dspAffinityArg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(dspAffinityArg);
+
+    SoapySDR::ArgInfo spectrumSizeArg;
+
+    spectrumSizeArg.key = "spectrum_size";
+    spectrumSizeArg.value = std::to_string(SpectrumMonitor::DEFAULT_SIZE);
+    spectrumSizeArg.name = "Spectrum size";
+    spectrumSizeArg.description = "FFT size of the pipe spectrum monitor, a power of two. readSetting(\"spectrum\") or "
+        "\"spectrum@<pipe>\" returns the averaged power per bin in dBFS, DC in the middle; the pipe is only analysed "
+        "while it is read";
+    spectrumSizeArg.type = SoapySDR::ArgInfo::INT;
+
+    setArgs.push_back(spectrumSizeArg);
+
+    SoapySDR::ArgInfo scenarioArg;
+
+    scenarioArg.key = "scenario";
+    scenarioArg.value = "";
+    scenarioArg.name = "Channel scenario";
+    scenarioArg.description = "Path of a JSON file scheduling gain_db, freq_offset_hz, snr_db, link and delay changes at "
+        "Tx sample ticks, applied sample accurately to the Tx streams; empty to clear";
+    scenarioArg.type = SoapySDR::ArgInfo::STRING;
+
+    setArgs.push_back(scenarioArg);
+
     SoapySDR_logf(SOAPY_SDR_DEBUG, "SETARGS?");
 
     return setArgs;
@@ -487,8 +621,63 @@ void SoapyLoopback::writeSetting(const std::string &key, const std::string &valu
     else if (key == "digital_agc")
     {
         digitalAGC = (value == "true") ? true : false;
-        SoapySDR_logf(SOAPY_SDR_DEBUG, "RTL-SDR digital agc mode: %s", digitalAGC ? "true" : "false");
-        //rtlsdr_set_agc_mode(dev, digitalAGC ? 1 : 0);
+        SoapySDR_logf(SOAPY_SDR_DEBUG, "Loopback digital agc mode: %s", digitalAGC ? "true" : "false");
+    }
+    else if (key == "trace")
+    {
+        Trace::setEnabled(value == "true");
+        SoapySDR_logf(SOAPY_SDR_DEBUG, "Loopback tracing: %s", Trace::enabled() ? "true" : "false");
+    }
+    else if (key == "trace_dump")
+    {
+        if (!Trace::dump(value))
+            throw std::runtime_error("SoapyLoopback::writeSetting(trace_dump) - can not write '" + value + "'");
+    }
+    else if (key == "stats_reset")
+    {
+        std::unique_lock lock(streamsMutex);
+        for (const auto &stream: streams)
+        {
+            if (stream->pipe)
+                stream->pipe->getStats().reset();
+            if (stream->nullSink)
+            {
+                stream->nullSink->stats.reset();
+                stream->nullSink->resetChecks();
+            }
+            if (stream->mediumPort)
+                stream->mediumPort->stats.reset();
+            stream->levels.reset();
+        }
+        SoapySDR_log(SOAPY_SDR_DEBUG, "Loopback pipe statistics reset");
+    }
+    else if (key == "dsp_threads" || key == "dsp_affinity")
+    {
+        if (key == "dsp_threads")
+            dspThreads = std::stoul(value);
+        else
+            dspConfig.cpus = parseCpuList(value);
+        const size_t threads = dspThreads > 0 ? dspThreads : std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        WorkerPool::instance().configure(threads, dspConfig);
+        SoapySDR_logf(SOAPY_SDR_DEBUG, "Loopback DSP workers: %zu", threads);
+    }
+    else if (key == "spectrum_size")
+    {
+        const size_t size = std::stoul(value);
+        if (size < 2 || (size & (size - 1)) != 0)
+            throw std::runtime_error("SoapyLoopback::writeSetting(spectrum_size) - " + value + " is not a power of two");
+        spectrumSize = size;
+    }
+    else if (key == "scenario")
+    {
+        // parse outside the lock, a broken file leaves the current scenario in place
+        std::shared_ptr<const Scenario> loaded = value.empty() ? nullptr : Scenario::load(value);
+        {
+            std::unique_lock lock(scenarioMutex);
+            scenario = std::move(loaded);
+            scenarioVersion++;
+        }
+        SoapySDR_logf(SOAPY_SDR_DEBUG, "Loopback scenario: %s", value.empty() ? "none" : value.c_str());
     }
 }
 
@@ -502,6 +691,31 @@ std::string SoapyLoopback::readSetting(const std::string &key) const
         return offsetMode?"true":"false";
     } else if (key == "digital_agc") {
         return digitalAGC?"true":"false";
+    } else if (key == "trace") {
+        return Trace::enabled()?"true":"false";
+    } else if (key == "pipes") {
+        return std::to_string(Connector::registrySize());
+    } else if (key == "dsp_threads") {
+        return std::to_string(WorkerPool::instance().size());
+    } else if (key == "dsp_steals") {
+        return std::to_string(WorkerPool::instance().steals());
+    } else if (key == "scenario") {
+        std::unique_lock lock(scenarioMutex);
+        return scenario ? scenario->getPath() : "";
+    }
+
+    //pipe statistics, "<stat>" for the newest stream or "<stat>@<pipe>" for a given pipe
+    std::string value;
+    const size_t at = key.find('@');
+    const std::string name = key.substr(0, at);
+    if (name == "fd" || name == "fd_data" || name == "fd_empty") {
+        return std::to_string(readPipeFd(at == std::string::npos ? "" : key.substr(at + 1), name));
+    }
+    if (name == "spectrum") {
+        return readSpectrum(at == std::string::npos ? "" : key.substr(at + 1));
+    }
+    if (readStreamStat(-1, at == std::string::npos ? "" : key.substr(at + 1), key.substr(0, at), value)) {
+        return value;
     }
 
     SoapySDR_logf(SOAPY_SDR_WARNING, "Unknown setting '%s'", key.c_str());
@@ -596,6 +810,8 @@ std::vector<std::string> SoapyLoopback::listSensors(const int /*direction*/, con
 {
 	std::vector<std::string> sensors;
 	sensors.push_back("lo_locked");
+	for (const auto &info: pipeStatsInfo())
+		sensors.push_back(info.key);
 	return sensors;
 }
 
@@ -610,10 +826,15 @@ SoapySDR::ArgInfo SoapyLoopback::getSensorInfo(const int /*direction*/, const si
 		info.value = "false";
 		info.description = "LO synthesizer is locked, good VCO selection.";
 	}
+	for (const auto &stat: pipeStatsInfo())
+	{
+		if (stat.key == name)
+			info = stat;
+	}
 	return info;
 }
 
-std::string SoapyLoopback::readSensor(const int /*direction*/, const size_t /*channel*/, const std::string &name) const
+std::string SoapyLoopback::readSensor(const int direction, const size_t /*channel*/, const std::string &name) const
 {
 
 	if (name == "lo_locked")
@@ -621,5 +842,280 @@ std::string SoapyLoopback::readSensor(const int /*direction*/, const size_t /*ch
 		return "true";
 	}
 
+	std::string value;
+	if (readStreamStat(direction, "", name, value))
+	{
+		return value;
+	}
+
 	throw std::runtime_error("SoapyLoopback::readSensor("+name+") - unknown sensor name");
 }
+
+
+/*******************************************************************
+ * Pipe telemetry
+ ******************************************************************/
+
+static SoapySDR::ArgInfo pipeStat(const std::string &key, const std::string &name, const std::string &units, const std::string &description)
+{
+	SoapySDR::ArgInfo info;
+	info.key = key;
+	info.name = name;
+	info.type = SoapySDR::ArgInfo::INT;
+	info.value = "0";
+	info.units = units;
+	info.description = description;
+	return info;
+}
+
+/** Pipe stat with a fractional value */
+static SoapySDR::ArgInfo pipeStatFloat(const std::string &key, const std::string &name, const std::string &units, const std::string &description)
+{
+	SoapySDR::ArgInfo info = pipeStat(key, name, units, description);
+	info.type = SoapySDR::ArgInfo::FLOAT;
+	return info;
+}
+
+/** Rx signal level, measured once one of them is read */
+static SoapySDR::ArgInfo levelStat(const std::string &key, const std::string &name, const std::string &units, const std::string &description)
+{
+	return pipeStatFloat(key, name, units, description + " Measured every 65536 samples from the first read.");
+}
+
+const std::vector<SoapySDR::ArgInfo> &SoapyLoopback::pipeStatsInfo(void)
+{
+	static const std::vector<SoapySDR::ArgInfo> stats {
+		pipeStat("frames", "Frames", "frames", "Frames pushed from Tx to Rx."),
+		pipeStat("samples", "Samples", "samples", "Samples pushed from Tx to Rx."),
+		pipeStatFloat("rate_msps", "Rate", "Msps", "Average Tx rate since activation or stats_reset."),
+		pipeStat("frames_received", "Frames received", "frames", "Frames pulled by the Rx."),
+		pipeStat("tx2rx_depth", "Data queue depth", "frames", "Frames waiting for the Rx."),
+		pipeStat("rx2tx_depth", "Empty queue depth", "frames", "Empty frames available to the Tx."),
+		pipeStat("overflows", "Overflows", "events", "Tx timed out waiting for an empty frame."),
+		pipeStat("underflows", "Underflows", "events", "Rx timed out waiting for data."),
+		pipeStat("dropped_frames", "Dropped frames", "frames", "Frames discarded by backpressure=drop_newest or drop_oldest."),
+		pipeStat("dropped_samples", "Dropped samples", "samples", "Samples discarded by backpressure=drop_newest or drop_oldest."),
+		pipeStat("grown_frames", "Grown frames", "frames", "Frames added to the pool by backpressure=grow."),
+		pipeStat("pool_frames", "Pool frames", "frames", "Frames currently owned by the pool."),
+		pipeStat("pool_prefault_us", "Pool prefault time", "us", "Time spent faulting in and locking the pool when it was last built, prefault=true."),
+		pipeStat("pool_locked_bytes", "Pool locked", "bytes", "Bytes of the pool locked in memory, mlock=true."),
+		pipeStat("wait_empty_p50_us", "pullEmpty blocked p50", "us", "Median time the Tx blocked waiting for an empty frame."),
+		pipeStat("wait_empty_p99_us", "pullEmpty blocked p99", "us", "99th percentile of the time the Tx blocked waiting for an empty frame."),
+		pipeStat("wait_data_p50_us", "pullData blocked p50", "us", "Median time the Rx blocked waiting for data."),
+		pipeStat("wait_data_p99_us", "pullData blocked p99", "us", "99th percentile of the time the Rx blocked waiting for data."),
+		pipeStat("latency_p50_us", "Latency p50", "us", "Median Tx push to Rx pull frame latency."),
+		pipeStat("latency_p99_us", "Latency p99", "us", "99th percentile of the Tx push to Rx pull frame latency."),
+		pipeStat("latency_p999_us", "Latency p99.9", "us", "99.9th percentile of the Tx push to Rx pull frame latency."),
+		pipeStat("integrity_checked", "Integrity checked", "frames", "integrity=true: frames verified by the Rx."),
+		pipeStat("integrity_crc_errors", "Integrity CRC errors", "frames", "integrity=true: frames with a CRC32C mismatch."),
+		pipeStat("integrity_lost", "Integrity lost", "frames", "integrity=true: frames missing from the sequence."),
+		pipeStat("integrity_duplicated", "Integrity duplicated", "frames", "integrity=true: frames duplicated or received out of order."),
+		levelStat("rx_power_dbfs", "Rx power", "dBFS", "Average power of the received samples, before digital_agc and DC removal."),
+		levelStat("rx_peak_dbfs", "Rx peak", "dBFS", "Peak sample power of the last level window."),
+		levelStat("rx_dc_i", "Rx DC I", "", "Mean of I, +/-1.0 full scale."),
+		levelStat("rx_dc_q", "Rx DC Q", "", "Mean of Q, +/-1.0 full scale."),
+		levelStat("rx_iq_imbalance_db", "Rx IQ gain imbalance", "dB", "Power of I over power of Q, DC removed."),
+		levelStat("rx_iq_phase_deg", "Rx IQ phase imbalance", "deg", "Deviation of I and Q from quadrature."),
+		pipeStat("clip_count", "Clipped samples", "samples", "Received samples with I or Q at full scale since stats_reset."),
+		levelStat("agc_gain_db", "AGC gain", "dB", "Gain digital_agc applies to the Rx samples."),
+		pipeStat("null_checksum", "Null sink checksum", "", "pipe=null with null_check=checksum: checksum of everything written since activation or stats_reset."),
+		pipeStat("prbs_errors", "Null sink PRBS errors", "bits", "pipe=null with null_check=prbs: bits not matching the PRBS15 pattern."),
+		pipeStat("prbs_bits", "Null sink PRBS bits", "bits", "pipe=null with null_check=prbs: bits checked."),
+	};
+	return stats;
+}
+
+bool SoapyLoopback::readStreamStat(const int direction, const std::string &pipeName, const std::string &name, std::string &value) const
+{
+	const auto &infos = pipeStatsInfo();
+	if (std::none_of(infos.begin(), infos.end(), [&name](const SoapySDR::ArgInfo &info) { return info.key == name; }))
+		return false;
+
+	std::unique_lock lock(streamsMutex);
+	for (auto it = streams.rbegin(); it != streams.rend(); ++it)
+	{
+		if ((direction < 0 || (*it)->direction == direction) && (pipeName.empty() || (*it)->pipeName == pipeName))
+			return readPipeStat(it->get(), name, value);
+	}
+	return readPipeStat(nullptr, name, value);
+}
+
+int SoapyLoopback::readPipeFd(const std::string &pipeName, const std::string &name) const
+{
+	std::unique_lock lock(streamsMutex);
+	for (auto it = streams.rbegin(); it != streams.rend(); ++it)
+	{
+		const SoapySDR::Stream &stream = **it;
+		if (!stream.pipe || (!pipeName.empty() && stream.pipeName != pipeName))
+			continue;
+		//"fd" is the one the stream waits on: data for an Rx, empty frames for a Tx
+		const bool data = (name == "fd") ? stream.direction == SOAPY_SDR_RX : name == "fd_data";
+		return data ? stream.pipe->getDataFd() : stream.pipe->getEmptyFd();
+	}
+	return -1;
+}
+
+std::string SoapyLoopback::readSpectrum(const std::string &pipeName) const
+{
+	std::shared_ptr<Connector> pipe;
+	ThreadConfig threads;
+	{
+		std::unique_lock lock(streamsMutex);
+		for (auto it = streams.rbegin(); it != streams.rend() && !pipe; ++it)
+		{
+			if ((*it)->pipe && (pipeName.empty() || (*it)->pipeName == pipeName))
+			{
+				pipe = (*it)->pipe;
+				threads = (*it)->threads;
+			}
+		}
+	}
+	if (!pipe)
+		return "";
+
+	//the FFT thread is placed like the stream, it must not land on the cores kept free for others
+	SpectrumMonitor &monitor = pipe->getSpectrum(spectrumSize, threads);
+	if (monitor.size() != spectrumSize)
+		monitor.setSize(spectrumSize);
+	std::string result;
+	for (const float bin : monitor.read())
+	{
+		if (!result.empty())
+			result += ",";
+		result += fmt::format("{:.1f}", bin);
+	}
+	return result;
+}
+
+bool SoapyLoopback::readPipeStat(const SoapySDR::Stream *stream, const std::string &name, std::string &value)
+{
+	if (!stream)
+	{
+		value = "0";
+		return true;
+	}
+
+	if (name.rfind("rx_", 0) == 0 || name == "clip_count" || name == "agc_gain_db")
+	{
+		//levels are measured by the Rx from the first read on
+		stream->levels.armed = true;
+		const LevelMeter::Measurement levels = stream->levels.last();
+		if (name == "rx_power_dbfs")
+			value = fmt::format("{:.2f}", levels.powerDbfs);
+		else if (name == "rx_peak_dbfs")
+			value = fmt::format("{:.2f}", levels.peakDbfs);
+		else if (name == "rx_dc_i")
+			value = fmt::format("{:.6f}", levels.dc.real());
+		else if (name == "rx_dc_q")
+			value = fmt::format("{:.6f}", levels.dc.imag());
+		else if (name == "rx_iq_imbalance_db")
+			value = fmt::format("{:.3f}", levels.imbalanceDb);
+		else if (name == "rx_iq_phase_deg")
+			value = fmt::format("{:.3f}", levels.phaseDeg);
+		else if (name == "clip_count")
+			value = std::to_string(stream->levels.clipped());
+		else
+			value = fmt::format("{:.2f}", stream->agcGainDb.load(std::memory_order_relaxed));
+		return true;
+	}
+
+	if (name == "rate_msps" || stream->nullSink)
+	{
+		const ConnectorStats *stats = stream->pipe ? &stream->pipe->getStats()
+			: stream->nullSink ? &stream->nullSink->stats
+			: stream->mediumPort ? &stream->mediumPort->stats : nullptr;
+		if (name == "rate_msps")
+			value = std::to_string(stats ? stats->pushedMsps(stream->itemSize) : 0.0);
+		else if (name == "frames")
+			value = std::to_string(stats->framesPushed.load(std::memory_order_relaxed));
+		else if (name == "samples")
+			value = std::to_string(stats->bytesPushed.load(std::memory_order_relaxed) / stream->itemSize);
+		else if (name == "null_checksum")
+			value = std::to_string(stream->nullSink->checksum());
+		else if (name == "prbs_errors")
+			value = std::to_string(stream->nullSink->prbsErrors());
+		else if (name == "prbs_bits")
+			value = std::to_string(stream->nullSink->prbsBits());
+		else
+			value = "0";
+		return true;
+	}
+
+	if (stream->mediumPort)
+	{
+		const ConnectorStats &stats = stream->mediumPort->stats;
+		if (name == "frames")
+			value = std::to_string(stats.framesPushed.load(std::memory_order_relaxed));
+		else if (name == "samples")
+			value = std::to_string(stats.bytesPushed.load(std::memory_order_relaxed) / stream->itemSize);
+		else if (name == "overflows")
+			value = std::to_string(stats.overflows.load(std::memory_order_relaxed));
+		else if (name == "underflows")
+			value = std::to_string(stats.underflows.load(std::memory_order_relaxed));
+		else
+			value = "0";
+		return true;
+	}
+
+	if (!stream->pipe)
+	{
+		value = "0";
+		return true;
+	}
+
+	Connector &pipe = *stream->pipe;
+	const ConnectorStats &stats = pipe.getStats();
+	unsigned long long result = 0;
+
+	if (name == "frames")
+		result = stats.framesPushed.load(std::memory_order_relaxed);
+	else if (name == "samples")
+		result = stream->itemSize ? stats.bytesPushed.load(std::memory_order_relaxed) / stream->itemSize : 0;
+	else if (name == "frames_received")
+		result = stats.framesPulled.load(std::memory_order_relaxed);
+	else if (name == "tx2rx_depth")
+		result = pipe.dataDepth();
+	else if (name == "rx2tx_depth")
+		result = pipe.emptyDepth();
+	else if (name == "overflows")
+		result = stats.overflows.load(std::memory_order_relaxed);
+	else if (name == "underflows")
+		result = stats.underflows.load(std::memory_order_relaxed);
+	else if (name == "dropped_frames")
+		result = stats.droppedFrames.load(std::memory_order_relaxed);
+	else if (name == "dropped_samples")
+		result = stream->itemSize ? stats.droppedBytes.load(std::memory_order_relaxed) / stream->itemSize : 0;
+	else if (name == "grown_frames")
+		result = stats.grownFrames.load(std::memory_order_relaxed);
+	else if (name == "pool_frames")
+		result = pipe.poolSize();
+	else if (name == "pool_prefault_us")
+		result = stats.prefaultUs.load(std::memory_order_relaxed);
+	else if (name == "pool_locked_bytes")
+		result = stats.lockedBytes.load(std::memory_order_relaxed);
+	else if (name == "wait_empty_p50_us")
+		result = stats.waitEmpty.percentile(50);
+	else if (name == "wait_empty_p99_us")
+		result = stats.waitEmpty.percentile(99);
+	else if (name == "wait_data_p50_us")
+		result = stats.waitData.percentile(50);
+	else if (name == "wait_data_p99_us")
+		result = stats.waitData.percentile(99);
+	else if (name == "latency_p50_us")
+		result = stats.latency.percentile(50);
+	else if (name == "latency_p99_us")
+		result = stats.latency.percentile(99);
+	else if (name == "latency_p999_us")
+		result = stats.latency.percentile(99.9);
+	else if (name == "integrity_checked")
+		result = stats.integrityChecked.load(std::memory_order_relaxed);
+	else if (name == "integrity_crc_errors")
+		result = stats.integrityCrcErrors.load(std::memory_order_relaxed);
+	else if (name == "integrity_lost")
+		result = stats.integrityLost.load(std::memory_order_relaxed);
+	else if (name == "integrity_duplicated")
+		result = stats.integrityDuplicated.load(std::memory_order_relaxed);
+
+	value = std::to_string(result);
+	return true;
+}
@@ -29,11 +29,18 @@
 #include <SoapySDR/Time.hpp>
 #include <algorithm>
 #include <climits>
+#include <cmath>
 #include <cstring>
 #include <string>
 
+#include "SoapyLoopbackGenerator.hpp"
+#include "SoapyLoopbackMedium.hpp"
+#include "SoapyLoopbackNullSink.hpp"
 #include "config.h"
 
+//smallest frame latency_us derives, below it the per frame overhead dominates
+static constexpr size_t MIN_LATENCY_FRAME = 64;
+
 std::vector<std::string> SoapyLoopback::getStreamFormats(const int direction, const size_t channel) const {
     std::vector<std::string> formats;
 
@@ -73,16 +80,222 @@ SoapySDR::ArgInfoList SoapyLoopback::getStreamArgsInfo(const int direction, cons
 
     streamArgs.push_back(buffersArg);
 
+    SoapySDR::ArgInfo latencyArg;
+    latencyArg.key = "latency_us";
+    latencyArg.value = "";
+    latencyArg.name = "Target latency";
+    latencyArg.description = "Tx only on a pipe: Tx -> Rx latency target. Derives bufflen and buffers from the sample rate "
+        "at setupStream, explicit bufflen or buffers take precedence. The Tx owns the pool, so the Rx reads the frames "
+        "the Tx sized; on an Rx it only sizes the frames of gen: and medium: streams.";
+    latencyArg.units = "us";
+    latencyArg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(latencyArg);
+
     SoapySDR::ArgInfo asyncbuffsArg;
     asyncbuffsArg.key = "pipe";
     asyncbuffsArg.value = DEFAULT_PIPE_NAME;
     asyncbuffsArg.name = "Pipe name";
-    asyncbuffsArg.description = "Pipe (Tx -> Rx) name. There are many pairs Tx Rx";
+    asyncbuffsArg.description = "Pipe (Tx -> Rx) name. There are many pairs Tx Rx. "
+        "Rx only: gen:tone, gen:noise, gen:chirp or gen:qpsk synthesizes samples without a Tx. "
+        "Tx only: null discards the samples and reports the achieved rate. "
+        "medium:<name> attaches to a shared virtual spectrum, every Rx receives the sum of the Tx streams "
+        "whose center frequency and bandwidth overlap its own, shifted, low-pass filtered and resampled into its band. "
+        "The medium has no Tx back-pressure: when a Tx writes faster than an Rx reads, the oldest samples beyond "
+        "the Rx buffers are dropped and counted as overflows.";
     asyncbuffsArg.units = "buffers";
     asyncbuffsArg.type = SoapySDR::ArgInfo::STRING;
 
     streamArgs.push_back(asyncbuffsArg);
 
+    SoapySDR::ArgInfo waitArg;
+    waitArg.key = "wait";
+    waitArg.value = "block";
+    waitArg.name = "Wait strategy";
+    waitArg.description = "How the stream waits for frames: spin (busy-poll, for isolated cores), hybrid (spin then block) or block.";
+    waitArg.type = SoapySDR::ArgInfo::STRING;
+    waitArg.options = {"spin", "hybrid", "block"};
+    waitArg.optionNames = {"Spin", "Spin then block", "Block"};
+
+    streamArgs.push_back(waitArg);
+
+    SoapySDR::ArgInfo affinityArg;
+    affinityArg.key = "affinity";
+    affinityArg.value = "";
+    affinityArg.name = "CPU affinity";
+    affinityArg.description = "CPU list (e.g. 2-3,6) for the thread activating the stream and the threads the module starts for its pipe. "
+        "The DSP workers are shared by all streams and follow the dsp_affinity setting instead.";
+    affinityArg.type = SoapySDR::ArgInfo::STRING;
+
+    streamArgs.push_back(affinityArg);
+
+    SoapySDR::ArgInfo rtPriorityArg;
+    rtPriorityArg.key = "rt_priority";
+    rtPriorityArg.value = "0";
+    rtPriorityArg.name = "Real-time priority";
+    rtPriorityArg.description = "SCHED_FIFO priority of the stream threads, see affinity, 0 keeps the default scheduler.";
+    rtPriorityArg.type = SoapySDR::ArgInfo::INT;
+    rtPriorityArg.range = SoapySDR::Range(0, 99);
+
+    streamArgs.push_back(rtPriorityArg);
+
+    SoapySDR::ArgInfo numaNodeArg;
+    numaNodeArg.key = "numa_node";
+    numaNodeArg.value = "-1";
+    numaNodeArg.name = "NUMA node";
+    numaNodeArg.description = "Run the stream threads on, and prefer memory of, this NUMA node, see affinity. -1 for any node, 0..63.";
+    numaNodeArg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(numaNodeArg);
+
+    SoapySDR::ArgInfo iqSwapArg;
+    iqSwapArg.key = "iq_swap";
+    iqSwapArg.value = "false";
+    iqSwapArg.name = "Swap I/Q";
+    iqSwapArg.description = "Rx only: readStream exchanges I and Q, which mirrors the spectrum.";
+    iqSwapArg.type = SoapySDR::ArgInfo::BOOL;
+
+    streamArgs.push_back(iqSwapArg);
+
+    SoapySDR::ArgInfo scaleArg;
+    scaleArg.key = "scale";
+    scaleArg.value = "1.0";
+    scaleArg.name = "Scale";
+    scaleArg.description = "Rx only: readStream multiplies the samples, integer formats saturate.";
+    scaleArg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(scaleArg);
+
+    SoapySDR::ArgInfo ntThresholdArg;
+    ntThresholdArg.key = "nt_threshold";
+    ntThresholdArg.value = "1048576";
+    ntThresholdArg.name = "Streaming store threshold";
+    ntThresholdArg.description = "Rx only: readStream calls copying at least this many bytes use non-temporal stores "
+        "that bypass the cache, 0 never.";
+    ntThresholdArg.units = "bytes";
+    ntThresholdArg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(ntThresholdArg);
+
+    SoapySDR::ArgInfo genFreqArg;
+    genFreqArg.key = "gen_freq";
+    genFreqArg.value = "";
+    genFreqArg.name = "Generator frequency";
+    genFreqArg.description = "Tone frequency or chirp half span (default sample rate / 16, chirp 0.4 * sample rate).";
+    genFreqArg.units = "Hz";
+    genFreqArg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(genFreqArg);
+
+    SoapySDR::ArgInfo genAmplitudeArg;
+    genAmplitudeArg.key = "gen_amplitude";
+    genAmplitudeArg.value = "0.7";
+    genAmplitudeArg.name = "Generator amplitude";
+    genAmplitudeArg.description = "Peak amplitude relative to full scale.";
+    genAmplitudeArg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(genAmplitudeArg);
+
+    SoapySDR::ArgInfo genNoiseArg;
+    genNoiseArg.key = "gen_noise";
+    genNoiseArg.value = "0";
+    genNoiseArg.name = "Generator noise";
+    genNoiseArg.description = "Additive gaussian noise RMS relative to full scale.";
+    genNoiseArg.type = SoapySDR::ArgInfo::FLOAT;
+
+    streamArgs.push_back(genNoiseArg);
+
+    SoapySDR::ArgInfo genPeriodArg;
+    genPeriodArg.key = "gen_period";
+    genPeriodArg.value = "65536";
+    genPeriodArg.name = "Chirp period";
+    genPeriodArg.description = "Chirp sweep length.";
+    genPeriodArg.units = "samples";
+    genPeriodArg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(genPeriodArg);
+
+    SoapySDR::ArgInfo genSpsArg;
+    genSpsArg.key = "gen_sps";
+    genSpsArg.value = "4";
+    genSpsArg.name = "QPSK samples per symbol";
+    genSpsArg.description = "Samples per PRBS15 QPSK symbol.";
+    genSpsArg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(genSpsArg);
+
+    SoapySDR::ArgInfo nullCheckArg;
+    nullCheckArg.key = "null_check";
+    nullCheckArg.value = "none";
+    nullCheckArg.name = "Null sink check";
+    nullCheckArg.description = "pipe=null only: checksum the samples or check them against the gen:qpsk PRBS15 pattern.";
+    nullCheckArg.type = SoapySDR::ArgInfo::STRING;
+    nullCheckArg.options = {"none", "checksum", "prbs"};
+    nullCheckArg.optionNames = {"None", "Checksum", "PRBS15 QPSK"};
+
+    streamArgs.push_back(nullCheckArg);
+
+    SoapySDR::ArgInfo integrityArg;
+    integrityArg.key = "integrity";
+    integrityArg.value = "false";
+    integrityArg.name = "Frame integrity";
+    integrityArg.description = "Tx stamps every frame with a sequence number and CRC32C, the Rx verifies them.";
+    integrityArg.type = SoapySDR::ArgInfo::BOOL;
+
+    streamArgs.push_back(integrityArg);
+
+    SoapySDR::ArgInfo dspPoolArg;
+    dspPoolArg.key = "dsp_pool";
+    dspPoolArg.value = "false";
+    dspPoolArg.name = "DSP worker pool";
+    dspPoolArg.description = "Tx only: process frames (integrity stamping) on the module worker pool, frames reach the pipe in order. Needs integrity=true, otherwise there is no work and it is ignored.";
+    dspPoolArg.type = SoapySDR::ArgInfo::BOOL;
+
+    streamArgs.push_back(dspPoolArg);
+
+    SoapySDR::ArgInfo backPressureArg;
+    backPressureArg.key = "backpressure";
+    backPressureArg.value = "block";
+    backPressureArg.name = "Back-pressure policy";
+    backPressureArg.description = "Tx only: what to do when the Rx falls behind. block waits up to the write timeout, "
+        "drop_newest discards the new samples, drop_oldest overwrites the oldest queued frame, "
+        "grow adds frames to the pool up to grow_max and then blocks. Drops are reported by dropped_frames/dropped_samples.";
+    backPressureArg.type = SoapySDR::ArgInfo::STRING;
+    backPressureArg.options = {"block", "drop_newest", "drop_oldest", "grow"};
+
+    streamArgs.push_back(backPressureArg);
+
+    SoapySDR::ArgInfo growMaxArg;
+    growMaxArg.key = "grow_max";
+    growMaxArg.value = "0";
+    growMaxArg.name = "Pool growth cap";
+    growMaxArg.description = "backpressure=grow: maximum number of frames in the pool, 0 for four times buffers.";
+    growMaxArg.type = SoapySDR::ArgInfo::INT;
+
+    streamArgs.push_back(growMaxArg);
+
+    SoapySDR::ArgInfo prefaultArg;
+    prefaultArg.key = "prefault";
+    prefaultArg.value = poolMemory.prefault ? "true" : "false";
+    prefaultArg.name = "Prefault pool";
+    prefaultArg.description = "Tx only: fault in the pipe frame pool when activateStream builds it, so the first pass through "
+        "the frames does not page fault. Paid once per pool, an activation reusing the pool skips it. "
+        "The time it took is reported by pool_prefault_us, benchmarks/PoolBenchmark.cpp compares it to the first pass "
+        "without it. Defaults to the device arg.";
+    prefaultArg.type = SoapySDR::ArgInfo::BOOL;
+
+    streamArgs.push_back(prefaultArg);
+
+    SoapySDR::ArgInfo mlockArg;
+    mlockArg.key = "mlock";
+    mlockArg.value = poolMemory.lock ? "true" : "false";
+    mlockArg.name = "Lock pool";
+    mlockArg.description = "Tx only: mlock the pipe frame pool at activation, a warning is logged when RLIMIT_MEMLOCK "
+        "does not allow it. Defaults to the device arg.";
+    mlockArg.type = SoapySDR::ArgInfo::BOOL;
+
+    streamArgs.push_back(mlockArg);
+
     return streamArgs;
 }
 
@@ -96,7 +309,8 @@ SoapySDR::Stream *SoapyLoopback::setupStream(
         const std::vector<size_t> &channels,
         const SoapySDR::Kwargs &args)
 {
-    SoapySDR::Stream &result = stream;
+    auto newStream = std::make_unique<SoapySDR::Stream>();
+    SoapySDR::Stream &result = *newStream;
 
     SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopback::setupStream");
 
@@ -104,9 +318,29 @@ SoapySDR::Stream *SoapyLoopback::setupStream(
         SoapySDR_logf(SOAPY_SDR_INFO, "%s: %s", key.c_str(), value.c_str());
     }
 
-    result.bufferSize = (args.count("buffers") > 0) ? std::stoi(args.at("bufflen")) : DEFAULT_BUFFER_LENGTH;
+    result.bufferSize = (args.count("bufflen") > 0) ? std::stoi(args.at("bufflen")) : DEFAULT_BUFFER_LENGTH;
     result.noOfBuffers = (args.count("buffers") > 0) ? std::stoi(args.at("buffers")) : DEFAULT_NUM_BUFFERS;
     result.pipeName = (args.count("pipe") > 0) ? args.at("pipe") : DEFAULT_PIPE_NAME;
+    result.direction = direction;
+    result.wait = parseWaitStrategy((args.count("wait") > 0) ? args.at("wait") : "block");
+    result.threads = ThreadConfig::fromArgs(args);
+    result.format = format;
+    result.formatId = Convert::formatId(format);
+    result.args = args;
+    result.integrity = (args.count("integrity") > 0) && args.at("integrity") == "true";
+    result.copy.swapIQ = (args.count("iq_swap") > 0) && args.at("iq_swap") == "true";
+    result.copy.scale = (args.count("scale") > 0) ? std::stof(args.at("scale")) : 1.0f;
+    if (args.count("nt_threshold") > 0)
+        result.copy.streamingBytes = std::stoul(args.at("nt_threshold"));
+    result.backPressure = parseBackPressure((args.count("backpressure") > 0) ? args.at("backpressure") : "block");
+    if (SignalGenerator::isGeneratorPipe(result.pipeName) && direction != SOAPY_SDR_RX)
+    {
+        throw std::runtime_error("setupStream pipe '" + result.pipeName + "' is a signal generator, only available for Rx");
+    }
+    if (result.pipeName == NullSink::PIPE_NAME && direction != SOAPY_SDR_TX)
+    {
+        throw std::runtime_error("setupStream pipe 'null' is a sink, only available for Tx");
+    }
 
     //check the channel configuration
     if (channels.size() > 1 or (channels.size() > 0 and channels.at(0) != 0))
@@ -144,20 +378,69 @@ SoapySDR::Stream *SoapyLoopback::setupStream(
                 "setupStream invalid format '" + format
                         + "' -- Only CS8, CS16 and CF32 are supported by SoapyLoopback module.");
     }
+
+    if (args.count("latency_us") > 0)
+    {
+        //a sample waits at most one frame to fill on the Tx side and one to drain on the Rx side
+        const double latencyUs = std::stod(args.at("latency_us"));
+        if (!(latencyUs > 0))
+        {
+            throw std::runtime_error("setupStream latency_us must be positive");
+        }
+        if (direction == SOAPY_SDR_RX && !SignalGenerator::isGeneratorPipe(result.pipeName) && !Medium::isMediumPipe(result.pipeName))
+        {
+            SoapySDR_log(SOAPY_SDR_WARNING, "SoapyLoopback: latency_us has no effect on an Rx pipe stream, set it on the Tx");
+        }
+        const double sampleRate = tuningOf(direction).sampleRate;
+        const size_t frameElems = std::max<size_t>(MIN_LATENCY_FRAME, static_cast<size_t>(sampleRate * latencyUs / 2e6));
+        const double frameUs = frameElems * 1e6 / std::max(sampleRate, 1.0);
+        //the whole pool queued is at most twice the target, at least two frames per side
+        const size_t frames = std::max<size_t>(4, static_cast<size_t>(std::ceil(2 * latencyUs / frameUs)));
+        if (args.count("bufflen") == 0)
+            result.bufferSize = frameElems * result.itemSize;
+        if (args.count("buffers") == 0)
+            result.noOfBuffers = frames;
+        SoapySDR_logf(SOAPY_SDR_INFO, "SoapyLoopback: latency %.0f us at %.0f sps, %zu samples per frame (%.1f us)",
+            latencyUs, sampleRate, frameElems, frameUs);
+    }
+    result.growMax = (args.count("grow_max") > 0) ? std::stoul(args.at("grow_max")) : 0;
+    result.poolMemory = PoolMemory::fromArgs(args, poolMemory);
+    if (result.growMax == 0)
+        result.growMax = 4 * result.noOfBuffers;
     SoapySDR_logf(SOAPY_SDR_INFO, "Loopback Using buffer length %d, %d buffers, item size = %d", result.bufferSize, result.noOfBuffers, result.itemSize);
 
 //allocate buffers postphoned till stream activation
-    return &stream;
+    std::unique_lock lock(streamsMutex);
+    streams.push_back(std::move(newStream));
+    return &result;
 }
 
 void SoapyLoopback::closeStream(SoapySDR::Stream *stream)
 {
-
+    //the pipe reference is dropped with the stream, the registry frees the pipe once both ends are closed
+    std::unique_lock lock(streamsMutex);
+    auto it = std::find_if(streams.begin(), streams.end(),
+        [stream](const std::unique_ptr<SoapySDR::Stream> &s) { return s.get() == stream; });
+    if (it == streams.end())
+    {
+        SoapySDR_log(SOAPY_SDR_ERROR, "SoapyLoopback::closeStream unknown stream");
+        return;
+    }
+    if ((*it)->aquired.frame && (*it)->pipe)
+    {
+        //return a frame the user did not release, so the pool keeps its size
+        (*it)->pipe->pushEmpty(std::move((*it)->aquired.frame));
+    }
+    if ((*it)->medium)
+    {
+        (*it)->medium->detach((*it)->mediumPort);
+    }
+    streams.erase(it);
 }
 
 size_t SoapyLoopback::getStreamMTU(SoapySDR::Stream *stream) const
 {
-    return bufferLength / BYTES_PER_SAMPLE;
+    return stream->bufferSize / stream->itemSize;
 }
 
 /*******************************************************************
@@ -171,8 +454,10 @@ size_t SoapyLoopback::getNumDirectAccessBuffers(SoapySDR::Stream *stream)
 
 int SoapyLoopback::getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs)
 {
-    if (buffer.aquired.frame)
-        buffs[0] = (void *)buffer.aquired.frame->data.data();
+    if (stream->direction == SOAPY_SDR_RX && stream->aquired.frame && stream->aquired.format != stream->formatId)
+        buffs[0] = stream->converted.data();
+    else if (stream->aquired.frame)
+        buffs[0] = (void *)stream->aquired.frame->payload();
     else
         buffs[0] = nullptr;
     return 0;
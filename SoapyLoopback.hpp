@@ -32,11 +32,14 @@
 #include <mutex>
 #include <memory>
 #include <queue>
+#include <vector>
 #include <condition_variable>
 #include <atomic>
 
 #include "SoapyLoopbackConnector.hpp"
 
+class Scenario;
+
 class SoapyLoopback: public SoapySDR::Device
 {
 public:
@@ -56,7 +59,7 @@ public:
      * Channels API
      ******************************************************************/
 
-    bool getFullDuplex(const int direction, const size_t channel) const;
+    bool getFullDuplex(const int direction, const size_t channel) const override;
 
     /*******************************************************************
      * Stream API
@@ -89,6 +92,10 @@ public:
 
     bool hasDCOffsetMode(const int direction, const size_t channel) const;
 
+    void setDCOffsetMode(const int direction, const size_t channel, const bool automatic);
+
+    bool getDCOffsetMode(const int direction, const size_t channel) const;
+
     bool hasFrequencyCorrection(const int direction, const size_t channel) const;
 
     void setFrequencyCorrection(const int direction, const size_t channel, const double value);
@@ -213,7 +220,46 @@ public:
     std::string readSetting(const std::string &key) const;
 
 protected:
-    SoapySDR::Stream stream;
+    /*******************************************************************
+     * Pipe telemetry, shared by the Sensor and Settings API
+     ******************************************************************/
+
+    static const std::vector<SoapySDR::ArgInfo> &pipeStatsInfo(void);
+
+    static bool readPipeStat(const SoapySDR::Stream *stream, const std::string &name, std::string &value);
+
+    /** Read a stat of the newest stream of the direction (-1 any) or of the named pipe */
+    bool readStreamStat(const int direction, const std::string &pipeName, const std::string &name, std::string &value) const;
+
+    /** fd, fd_data or fd_empty of the newest stream or of the named pipe, -1 without a pipe */
+    int readPipeFd(const std::string &pipeName, const std::string &name) const;
+
+    /** Averaged spectrum of the newest stream or of the named pipe as comma separated dBFS */
+    std::string readSpectrum(const std::string &pipeName) const;
+
+    mutable std::mutex streamsMutex;
+    std::vector<std::unique_ptr<SoapySDR::Stream>> streams;
+
+    /** Tuning of one direction, written by the settings and read by the streaming threads */
+    struct Tuning {
+        std::atomic<double> sampleRate {2048000};
+        std::atomic<double> centerFrequency {100000000};
+        std::atomic<double> bandwidth {0};  ///< 0 for the full sample rate
+    };
+
+    Tuning &tuningOf(const int direction) { return tuning[direction == SOAPY_SDR_TX ? SOAPY_SDR_TX : SOAPY_SDR_RX]; }
+    const Tuning &tuningOf(const int direction) const { return tuning[direction == SOAPY_SDR_TX ? SOAPY_SDR_TX : SOAPY_SDR_RX]; }
+
+    /** Push the current tuning of the direction to the medium ports of its streams */
+    void retuneMedium(const int direction);
+
+    /** Hardware time in ticks of the sample rate of the direction */
+    long long currentTicks(const int direction) const;
+
+    /** Move the hardware time forward to tick of the sample rate of the direction, never backwards */
+    void advanceTicks(const int direction, const long long tick);
+
+    std::chrono::microseconds pipeTimeout(const long timeoutUs) const;
 
     // clock API
     std::string _ref_source;
@@ -221,25 +267,29 @@ protected:
     std::string time_source;
 
     //int tunerType;
-    uint32_t sampleRate, centerFrequency, bandwidth;
+    Tuning tuning[2];   ///< indexed by direction, a transceiver tunes Tx and Rx apart
     double ppm, directSamplingMode;
     size_t numBuffers, bufferLength, asyncBuffs;
-    bool iqSwap, gainMode, offsetMode, digitalAGC, biasTee;
+    bool iqSwap, gainMode, offsetMode, biasTee;
+    std::atomic<bool> digitalAGC;    ///< Rx streams level their output to AGC_TARGET_DBFS
     double IFGain[6], tunerGain;
-    std::atomic<long long> ticks;
-
-  protected:
-    struct {    
-        struct {
-            std::unique_ptr<Frame> frame;
-            size_t bufferedElems;
-            char *currentBuff;
-        } aquired { {}, 0, nullptr};
-        
-        std::atomic<bool> reset;
-        std::atomic<bool> overflow;
-        long long ticks;
-    } buffer;
+    std::atomic<long long> timeNs;   ///< hardware time, in ns so it does not depend on either sample rate
+    /**
+     * Time source "sim": the hardware time advances with the samples the streams consume
+     * and the pipe waits block until data arrives instead of timing out.
+     */
+    std::atomic<bool> simTime;
 
     double gainMin, gainMax;
+
+    size_t dspThreads;
+    ThreadConfig dspConfig;
+    size_t spectrumSize;
+    std::atomic<bool> dcOffsetMode;  ///< Rx streams remove the DC they measure
+    PoolMemory poolMemory;           ///< prefault and mlock device args, the defaults of the streams
+
+    /** Channel scenario the Tx streams play, replaced as a whole by writeSetting("scenario") */
+    mutable std::mutex scenarioMutex;
+    std::shared_ptr<const Scenario> scenario;
+    std::atomic<uint64_t> scenarioVersion;  ///< bumped on each change, the streams compare it per frame
 };
@@ -0,0 +1,164 @@
+#include "SoapyLoopbackAsync.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <SoapySDR/Logger.hpp>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace LoopbackAsync {
+
+EventLoop::EventLoop() {
+#ifdef __linux__
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0)
+        throw std::runtime_error(std::string("LoopbackAsync::EventLoop: ") + strerror(errno));
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+#else
+    throw std::runtime_error("LoopbackAsync::EventLoop needs epoll and eventfd");
+#endif
+}
+
+EventLoop::~EventLoop() {
+#ifdef __linux__
+    // coroutines still waiting are destroyed with the frames they hold
+    for (auto &[fd, list] : waiters) {
+        for (auto &waiter : list)
+            waiter.handle.destroy();
+    }
+    close(wakeFd);
+    close(epollFd);
+#endif
+}
+
+void EventLoop::watch(Connector &pipe, int fd, std::function<bool()> ready, std::coroutine_handle<> handle) {
+#ifdef __linux__
+    // a closed fd number may already be reused by the pipe asking now
+    dropClosed();
+    auto [it, created] = waiters.try_emplace(fd);
+    if (created) {
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+            SoapySDR_logf(SOAPY_SDR_ERROR, "LoopbackAsync::EventLoop::watch fd %d: %s", fd, strerror(errno));
+        std::weak_ptr<ClosedFds> weak = closed;
+        pipe.onFdClose([weak, fd](int closing) {
+            auto closedFds = weak.lock();
+            if (closedFds && closing == fd) {
+                std::unique_lock lock(closedFds->mutex);
+                closedFds->fds.push_back(fd);
+            }
+        });
+    }
+    it->second.push_back(Waiter{std::move(ready), handle});
+    count++;
+#endif
+}
+
+void EventLoop::run() {
+    while (!stopping.exchange(false) && count > 0)
+        poll(std::chrono::milliseconds(-1));
+}
+
+void EventLoop::stop() {
+#ifdef __linux__
+    stopping = true;
+    eventfd_write(wakeFd, 1);
+#endif
+}
+
+void EventLoop::dropClosed() {
+    std::vector<int> fds;
+    {
+        std::unique_lock lock(closed->mutex);
+        fds.swap(closed->fds);
+    }
+    // closing the fd already removed it from the epoll set
+    for (const int fd : fds) {
+        auto it = waiters.find(fd);
+        if (it == waiters.end())
+            continue;
+        if (!it->second.empty())
+            SoapySDR_logf(SOAPY_SDR_WARNING, "LoopbackAsync::EventLoop: pipe closed fd %d with %zu coroutines waiting", fd, it->second.size());
+        for (auto &waiter : it->second)
+            waiter.handle.destroy();
+        count -= it->second.size();
+        waiters.erase(it);
+    }
+}
+
+size_t EventLoop::poll(std::chrono::milliseconds timeout) {
+#ifdef __linux__
+    epoll_event events[64];
+    const int n = epoll_wait(epollFd, events, 64, static_cast<int>(timeout.count()));
+    if (n < 0 && errno != EINTR)
+        SoapySDR_logf(SOAPY_SDR_ERROR, "LoopbackAsync::EventLoop::poll: %s", strerror(errno));
+    // events of fds closed meanwhile are skipped below
+    dropClosed();
+
+    size_t resumed = 0;
+    for (int i = 0; i < n; i++) {
+        const int fd = events[i].data.fd;
+        if (fd == wakeFd) {
+            eventfd_t value;
+            eventfd_read(wakeFd, &value);
+            continue;
+        }
+
+        auto it = waiters.find(fd);
+        if (it == waiters.end())
+            continue;
+        // resumed coroutines may wait on the same fd again, they append to the live list
+        std::vector<Waiter> list;
+        list.swap(it->second);
+        for (auto &waiter : list) {
+            // a resumed coroutine may have released the pipe, its fd is dropped in watch
+            auto live = waiters.find(fd);
+            if (live == waiters.end()) {
+                count--;
+                waiter.handle.destroy();
+                continue;
+            }
+            if (!waiter.ready()) {
+                live->second.push_back(std::move(waiter));
+                continue;
+            }
+            count--;
+            resumed++;
+            waiter.handle.resume();
+        }
+    }
+    return resumed;
+#else
+    return 0;
+#endif
+}
+
+bool FrameAwaiter::tryPull() {
+    if (!pipe.isActive())
+        return true;
+    frame = (kind == Kind::Data) ? pipe.pullData(Connector::POLL) : pipe.pullEmpty(Connector::POLL);
+    return frame != nullptr;
+}
+
+bool FrameAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    const int fd = (kind == Kind::Data) ? pipe.getDataFd() : pipe.getEmptyFd();
+    if (fd < 0)
+        throw std::runtime_error("LoopbackAsync: pipe " + pipe.getName() + " has no eventfd");
+    loop.watch(pipe, fd, [this]() { return tryPull(); }, handle);
+    return true;
+}
+
+}
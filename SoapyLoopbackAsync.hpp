@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "SoapyLoopbackConnector.hpp"
+
+/*
+ * Native C++20 API for users embedding the module: coroutines co_await the frames of a
+ * pipe and a single EventLoop thread drives any number of them through the eventfds of
+ * the pipes, instead of one thread blocked in readStream per stream.
+ *
+ *   LoopbackAsync::Task receive(LoopbackAsync::EventLoop &loop, std::shared_ptr<Connector> pipe) {
+ *       while (auto frame = co_await LoopbackAsync::nextData(loop, *pipe)) {
+ *           // use frame->payload(), frame->size()
+ *           pipe->pushEmpty(std::move(frame));
+ *       }
+ *   }
+ *
+ * The pipe eventfds are level triggered, a coroutine is resumed once its pull succeeds.
+ * Each fd stays registered with epoll while its pipe lives, so suspending again costs no
+ * epoll_ctl, and is dropped when the pipe closes it.
+ */
+namespace LoopbackAsync {
+
+    /** epoll loop resuming coroutines once the frame they wait for is available */
+    class EventLoop {
+      public:
+        EventLoop();
+        ~EventLoop();
+        EventLoop(const EventLoop &) = delete;
+        EventLoop &operator=(const EventLoop &) = delete;
+
+        /** Resume coroutines until stop() is called or none is waiting any more */
+        void run();
+
+        /** Wait up to timeout for events, returns the number of coroutines resumed */
+        size_t poll(std::chrono::milliseconds timeout);
+
+        /** Make run() return, callable from any thread */
+        void stop();
+
+        size_t waiting() const { return count; }
+
+        /**
+         * Resume handle once ready() returns true, checked each time fd of pipe becomes readable.
+         * Called by the awaiters from the loop thread, or before the loop runs.
+         */
+        void watch(Connector &pipe, int fd, std::function<bool()> ready, std::coroutine_handle<> handle);
+
+      private:
+        struct Waiter {
+            std::function<bool()> ready;
+            std::coroutine_handle<> handle;
+        };
+
+        /** fds closed by their pipe, reported from any thread and dropped by the loop thread */
+        struct ClosedFds {
+            std::mutex mutex;
+            std::vector<int> fds;
+        };
+
+        void dropClosed();
+
+        int epollFd {-1};
+        int wakeFd {-1};
+        std::unordered_map<int, std::vector<Waiter>> waiters;  ///< every registered fd, also without waiters
+        std::shared_ptr<ClosedFds> closed {std::make_shared<ClosedFds>()};
+        size_t count {0};
+        std::atomic<bool> stopping {false};
+    };
+
+    /** Detached coroutine, runs until its first suspension when called and frees itself when it returns */
+    struct Task {
+        struct promise_type {
+            Task get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    /** Awaits the next frame of a pipe, resumes with nullptr once the pipe is deactivated */
+    class FrameAwaiter {
+      public:
+        enum class Kind {
+            Data,   ///< frames pushed by the Tx, for the Rx side
+            Empty,  ///< recycled frames, for the Tx side
+        };
+
+        FrameAwaiter(EventLoop &loop, Connector &pipe, Kind kind): loop(loop), pipe(pipe), kind(kind) {}
+
+        bool await_ready() { return tryPull(); }
+        bool await_suspend(std::coroutine_handle<> handle);
+        std::unique_ptr<Frame> await_resume() { return std::move(frame); }
+
+      private:
+        bool tryPull();
+
+        EventLoop &loop;
+        Connector &pipe;
+        Kind kind;
+        std::unique_ptr<Frame> frame;
+    };
+
+    inline FrameAwaiter nextData(EventLoop &loop, Connector &pipe) {
+        return FrameAwaiter(loop, pipe, FrameAwaiter::Kind::Data);
+    }
+
+    inline FrameAwaiter nextEmpty(EventLoop &loop, Connector &pipe) {
+        return FrameAwaiter(loop, pipe, FrameAwaiter::Kind::Empty);
+    }
+}
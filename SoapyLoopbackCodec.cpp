@@ -0,0 +1,241 @@
+#include "SoapyLoopbackCodec.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Logger.hpp>
+
+#include "SoapyLoopbackConnector.hpp"
+#include "SoapyLoopbackWorkers.hpp"
+
+namespace IqCodec {
+
+namespace {
+
+inline uint16_t zigzag(uint16_t delta) {
+    int16_t d = static_cast<int16_t>(delta);
+    return static_cast<uint16_t>((d << 1) ^ (d >> 15));
+}
+
+inline uint16_t unzigzag(uint16_t z) {
+    return static_cast<uint16_t>((z >> 1) ^ -(z & 1));
+}
+
+inline uint8_t bitWidth(uint16_t v) {
+    return v ? static_cast<uint8_t>(32 - __builtin_clz(v)) : 0;
+}
+
+/* Pack CODEC_BLOCK values of the given width, always CODEC_BLOCK * width / 8 bytes */
+uint8_t *pack(const uint16_t *values, uint8_t width, uint8_t *out) {
+    uint64_t acc = 0;
+    unsigned bits = 0;
+    for (size_t i = 0; i < CODEC_BLOCK; i++) {
+        acc |= static_cast<uint64_t>(values[i]) << bits;
+        bits += width;
+        while (bits >= 8) {
+            *out++ = static_cast<uint8_t>(acc);
+            acc >>= 8;
+            bits -= 8;
+        }
+    }
+    return out;
+}
+
+const uint8_t *unpack(const uint8_t *in, uint8_t width, uint16_t *values) {
+    uint64_t acc = 0;
+    unsigned bits = 0;
+    const uint64_t mask = (1ull << width) - 1;
+    for (size_t i = 0; i < CODEC_BLOCK; i++) {
+        while (bits < width) {
+            acc |= static_cast<uint64_t>(*in++) << bits;
+            bits += 8;
+        }
+        values[i] = static_cast<uint16_t>(acc & mask);
+        acc >>= width;
+        bits -= width;
+    }
+    return in;
+}
+
+size_t encodeCS16(const int16_t *src, size_t numSamples, uint8_t *dst) {
+    uint8_t *out = dst;
+    uint16_t prevI = 0, prevQ = 0;
+    uint16_t zi[CODEC_BLOCK], zq[CODEC_BLOCK];
+
+    for (size_t base = 0; base < numSamples; base += CODEC_BLOCK) {
+        const size_t n = std::min(CODEC_BLOCK, numSamples - base);
+        const int16_t *s = src + 2 * base;
+        uint16_t orI = 0, orQ = 0;
+
+        // split loop so the compiler can vectorize the delta/zigzag/or-reduce pass
+        for (size_t i = 0; i < n; i++) {
+            uint16_t vi = static_cast<uint16_t>(s[2 * i]);
+            uint16_t vq = static_cast<uint16_t>(s[2 * i + 1]);
+            zi[i] = zigzag(static_cast<uint16_t>(vi - prevI));
+            zq[i] = zigzag(static_cast<uint16_t>(vq - prevQ));
+            prevI = vi;
+            prevQ = vq;
+        }
+        for (size_t i = n; i < CODEC_BLOCK; i++) {
+            zi[i] = zq[i] = 0;
+        }
+        for (size_t i = 0; i < CODEC_BLOCK; i++) {
+            orI |= zi[i];
+            orQ |= zq[i];
+        }
+
+        const uint8_t wI = bitWidth(orI);
+        const uint8_t wQ = bitWidth(orQ);
+        *out++ = wI;
+        *out++ = wQ;
+        out = pack(zi, wI, out);
+        out = pack(zq, wQ, out);
+    }
+    return out - dst;
+}
+
+bool decodeCS16(const uint8_t *src, size_t srcBytes, int16_t *dst, size_t numSamples) {
+    const uint8_t *in = src;
+    const uint8_t *end = src + srcBytes;
+    uint16_t prevI = 0, prevQ = 0;
+    uint16_t zi[CODEC_BLOCK], zq[CODEC_BLOCK];
+
+    for (size_t base = 0; base < numSamples; base += CODEC_BLOCK) {
+        if (end - in < 2)
+            return false;
+        const uint8_t wI = *in++;
+        const uint8_t wQ = *in++;
+        if (wI > 16 || wQ > 16)
+            return false;
+        if (static_cast<size_t>(end - in) < (wI + wQ) * CODEC_BLOCK / 8)
+            return false;
+        in = unpack(in, wI, zi);
+        in = unpack(in, wQ, zq);
+
+        const size_t n = std::min(CODEC_BLOCK, numSamples - base);
+        int16_t *d = dst + 2 * base;
+        for (size_t i = 0; i < n; i++) {
+            prevI = static_cast<uint16_t>(prevI + unzigzag(zi[i]));
+            prevQ = static_cast<uint16_t>(prevQ + unzigzag(zq[i]));
+            d[2 * i] = static_cast<int16_t>(prevI);
+            d[2 * i + 1] = static_cast<int16_t>(prevQ);
+        }
+    }
+    return in == end;
+}
+
+}
+
+size_t maxEncodedSize(size_t rawBytes) {
+    // worst case CS16: 2 width bytes + 2 * 16 bit per block, plus padding of the tail block
+    const size_t blocks = (rawBytes / 4 + CODEC_BLOCK - 1) / CODEC_BLOCK;
+    return sizeof(Header) + std::max(rawBytes, blocks * (2 + 4 * CODEC_BLOCK));
+}
+
+size_t encode(const std::string &format, const void *payload, size_t bytes, uint8_t *dst) {
+    Header header {MAGIC, MODE_STORED, {0, 0, 0}, static_cast<uint32_t>(bytes), 0};
+    uint8_t *out = dst + sizeof(Header);
+
+    if (format == SOAPY_SDR_CS16 && bytes % 4 == 0) {
+        header.mode = MODE_DELTA_CS16;
+        header.codedBytes = encodeCS16(static_cast<const int16_t *>(payload), bytes / 4, out);
+        if (header.codedBytes >= bytes) {
+            // noise-like frame, storing is cheaper to decode
+            header.mode = MODE_STORED;
+        }
+    }
+    if (header.mode == MODE_STORED) {
+        header.codedBytes = bytes;
+        memcpy(out, payload, bytes);
+    }
+
+    memcpy(dst, &header, sizeof(Header));
+    return sizeof(Header) + header.codedBytes;
+}
+
+size_t decode(const uint8_t *src, size_t codedBytes, void *dst, size_t dstCapacity) {
+    Header header;
+    if (codedBytes < sizeof(Header))
+        return 0;
+    memcpy(&header, src, sizeof(Header));
+    if (header.magic != MAGIC || header.rawBytes > dstCapacity || header.codedBytes != codedBytes - sizeof(Header)) {
+        SoapySDR_log(SOAPY_SDR_ERROR, "IqCodec::decode malformed frame");
+        return 0;
+    }
+
+    const uint8_t *payload = src + sizeof(Header);
+    switch (header.mode) {
+    case MODE_STORED:
+        if (header.codedBytes != header.rawBytes)
+            return 0;
+        memcpy(dst, payload, header.rawBytes);
+        return header.rawBytes;
+    case MODE_DELTA_CS16:
+        if (!decodeCS16(payload, header.codedBytes, static_cast<int16_t *>(dst), header.rawBytes / 4))
+            return 0;
+        return header.rawBytes;
+    default:
+        SoapySDR_logf(SOAPY_SDR_ERROR, "IqCodec::decode unknown mode %d", header.mode);
+        return 0;
+    }
+}
+
+size_t encode(const std::string &format, const Frame &frame, uint8_t *dst) {
+    return encode(format, frame.payload(), frame.size(), dst);
+}
+
+bool decode(const uint8_t *src, size_t codedBytes, Frame &frame) {
+    const size_t bytes = decode(src, codedBytes, frame.payload(), frame.capacity());
+    if (bytes == 0)
+        return false;
+    frame.resize(bytes);
+    return true;
+}
+
+namespace {
+
+/* Run job(i) for every block on the WorkerPool and wait for all of them */
+template <typename Job>
+void forEachBlock(size_t count, Job job) {
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining = count;
+    for (size_t i = 0; i < count; i++) {
+        WorkerPool::instance().submit([&, i]() {
+            job(i);
+            std::unique_lock lock(mutex);
+            if (--remaining == 0)
+                done.notify_all();
+        });
+    }
+    std::unique_lock lock(mutex);
+    done.wait(lock, [&]() { return remaining == 0; });
+}
+
+}
+
+void encodeBatch(const std::string &format, std::vector<Block> &blocks) {
+    forEachBlock(blocks.size(), [&](size_t i) {
+        Block &block = blocks[i];
+        block.coded.resize(maxEncodedSize(block.rawBytes));
+        block.coded.resize(encode(format, block.raw, block.rawBytes, block.coded.data()));
+    });
+}
+
+bool decodeBatch(std::vector<Block> &blocks) {
+    std::atomic<bool> ok {true};
+    forEachBlock(blocks.size(), [&](size_t i) {
+        Block &block = blocks[i];
+        const size_t bytes = decode(block.coded.data(), block.coded.size(), block.raw, block.rawBytes);
+        if (bytes == 0)
+            ok = false;
+        block.rawBytes = bytes;
+    });
+    return ok;
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Frame;
+
+/*
+ * Lossless per-frame IQ codec for the storage and network pipe backends.
+ *
+ * CS16 frames are coded as blocks of CODEC_BLOCK samples: I and Q are delta
+ * coded against the previous sample of the same component, zigzag mapped
+ * and bit-packed with the smallest width that fits the block. Silence
+ * between bursts collapses to the two width bytes per block. Every other
+ * format is stored verbatim, so decode(encode(x)) == x for any frame.
+ *
+ * A backend codes single frames with the payload or Frame overloads from its
+ * own thread, or hands a batch to encodeBatch/decodeBatch which spread the
+ * frames over the WorkerPool. benchmarks/CodecBenchmark.cpp reports the
+ * throughput in Msps per core and the compression ratio.
+ */
+namespace IqCodec {
+
+    constexpr size_t CODEC_BLOCK = 64;
+
+    enum Mode : uint8_t {
+        MODE_STORED = 0,
+        MODE_DELTA_CS16 = 1,
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint8_t mode;
+        uint8_t reserved[3];
+        uint32_t rawBytes;
+        uint32_t codedBytes;
+    };
+
+    constexpr uint32_t MAGIC = 0x3143424c; // "LBC1"
+
+    /* Upper bound of encode() output for a frame of rawBytes */
+    size_t maxEncodedSize(size_t rawBytes);
+
+    /* Encode bytes of payload in the given stream format, returns the number of bytes written to dst */
+    size_t encode(const std::string &format, const void *payload, size_t bytes, uint8_t *dst);
+
+    /* Decode a frame produced by encode(), returns the number of raw bytes written, 0 on malformed input */
+    size_t decode(const uint8_t *src, size_t codedBytes, void *dst, size_t dstCapacity);
+
+    /* Encode the valid payload of a pipe frame */
+    size_t encode(const std::string &format, const Frame &frame, uint8_t *dst);
+
+    /* Decode into the payload of a pipe frame and resize it, false on malformed input or a too small frame */
+    bool decode(const uint8_t *src, size_t codedBytes, Frame &frame);
+
+    /* One frame of a batch: encodeBatch reads raw and fills coded, decodeBatch reads coded and fills raw */
+    struct Block {
+        void *raw;
+        size_t rawBytes;
+        std::vector<uint8_t> coded;
+    };
+
+    /*
+     * Encode every block of the batch on the WorkerPool, one job per block, and return once
+     * all are coded. Must not be called from a WorkerPool job.
+     */
+    void encodeBatch(const std::string &format, std::vector<Block> &blocks);
+
+    /*
+     * Decode the coded bytes of every block into its raw buffer of rawBytes capacity on the
+     * WorkerPool, rawBytes is set to the decoded size. Returns false if any block is malformed
+     * or does not fit.
+     */
+    bool decodeBatch(std::vector<Block> &blocks);
+}
@@ -1,95 +1,679 @@
 #include "SoapyLoopbackConnector.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <mutex>
+#include <new>
 
 #include <fmt/core.h>
 #include <condition_variable>
 
 #include <SoapySDR/Logger.hpp>
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "SoapyLoopbackGenerator.hpp"
+#include "SoapyLoopbackMedium.hpp"
+#include "SoapyLoopbackNullSink.hpp"
+#include "SoapyLoopbackScenario.hpp"
+#include "SoapyLoopbackSpectrum.hpp"
+#include "SoapyLoopbackTrace.hpp"
+#include "SoapyLoopbackWorkers.hpp"
+
 using namespace std::chrono_literals;
 
+FrameSlab::FrameSlab(size_t bytes):
+    base(static_cast<unsigned char *>(::operator new(bytes, std::align_val_t(ALIGNMENT)))),
+    bytes(bytes) {
+}
+
+FrameSlab::~FrameSlab() {
+#ifdef __linux__
+    if (locked)
+        munlock(base, bytes);
+#endif
+    ::operator delete(base, std::align_val_t(ALIGNMENT));
+}
+
+void FrameSlab::prefault() {
+    if (prefaulted)
+        return;
+    prefaulted = true;
+#ifdef __linux__
+    static const size_t page = std::max<long>(sysconf(_SC_PAGESIZE), 64);
+#else
+    static const size_t page = 4096;
+#endif
+#ifdef MADV_POPULATE_WRITE
+    // one syscall faults in all whole pages, the touch loop below then only covers the edges
+    const uintptr_t first = (reinterpret_cast<uintptr_t>(base + offset) + page - 1) / page * page;
+    const uintptr_t last = reinterpret_cast<uintptr_t>(base + bytes) / page * page;
+    if (last > first)
+        madvise(reinterpret_cast<void *>(first), last - first, MADV_POPULATE_WRITE);
+#endif
+    // the carved part belongs to frames that may be in use, only the rest is written
+    volatile unsigned char *touch = base;
+    for (size_t i = offset; i < bytes; i += page - (reinterpret_cast<uintptr_t>(base + i) % page))
+        touch[i] = 0;
+}
+
+bool FrameSlab::lock() {
+#ifdef __linux__
+    if (!locked)
+        locked = mlock(base, bytes) == 0;
+#endif
+    return locked;
+}
+
+size_t FrameSlab::slotSize(size_t payloadBytes) {
+    return (sizeof(FrameHeader) + payloadBytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+FrameHeader *FrameSlab::carve(size_t payloadBytes) {
+    const size_t slot = slotSize(payloadBytes);
+    if (slot > remaining())
+        return nullptr;
+    FrameHeader *header = new (base + offset) FrameHeader{};
+    header->magic = FrameHeader::MAGIC;
+    header->headerSize = sizeof(FrameHeader);
+    header->channels = 1;
+    header->capacity = payloadBytes;
+    header->length = payloadBytes;
+    offset += slot;
+    return header;
+}
+
+Frame::Frame(size_t capacity):
+    slab(std::make_shared<FrameSlab>(FrameSlab::slotSize(capacity))),
+    hdr(slab->carve(capacity)) {
+}
+
+Frame::Frame(std::shared_ptr<FrameSlab> slab, FrameHeader *header):
+    slab(std::move(slab)),
+    hdr(header) {
+}
+
+void Histogram::record(std::chrono::nanoseconds duration) {
+    unsigned long long us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    size_t bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= BUCKETS)
+        bucket = BUCKETS - 1;
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long Histogram::count() const {
+    unsigned long long result = 0;
+    for (const auto &bucket: buckets)
+        result += bucket.load(std::memory_order_relaxed);
+    return result;
+}
+
+unsigned long long Histogram::percentile(double p) const {
+    unsigned long long total = count();
+    if (total == 0)
+        return 0;
+    unsigned long long rank = static_cast<unsigned long long>(p / 100.0 * total);
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return i ? 1ull << i : 0;
+    }
+    return 1ull << (BUCKETS - 1);
+}
+
+void Histogram::reset() {
+    for (auto &bucket: buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+void ConnectorStats::reset() {
+    framesPushed = 0;
+    bytesPushed = 0;
+    framesPulled = 0;
+    bytesPulled = 0;
+    overflows = 0;
+    underflows = 0;
+    droppedFrames = 0;
+    droppedBytes = 0;
+    grownFrames = 0;
+    waitEmpty.reset();
+    waitData.reset();
+    latency.reset();
+    sinceNs = nowNs();
+    integrityChecked = 0;
+    integrityCrcErrors = 0;
+    integrityLost = 0;
+    integrityDuplicated = 0;
+}
+
+long long ConnectorStats::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double ConnectorStats::pushedMsps(size_t itemSize) const {
+    const long long elapsed = nowNs() - sinceNs.load(std::memory_order_relaxed);
+    if (elapsed <= 0 || itemSize == 0)
+        return 0.0;
+    return 1e3 * (bytesPushed.load(std::memory_order_relaxed) / itemSize) / elapsed;
+}
+
+bool LevelMeter::add(const Convert::Levels &levels) {
+    clipCount.fetch_add(levels.clipped, std::memory_order_relaxed);
+    std::unique_lock lock(mutex);
+    window.add(levels);
+    if (window.samples < WINDOW)
+        return false;
+
+    const double n = static_cast<double>(window.samples);
+    const double meanI = window.sumI / n, meanQ = window.sumQ / n;
+    const double varI = window.sumII / n - meanI * meanI;
+    const double varQ = window.sumQQ / n - meanQ * meanQ;
+    const double covariance = window.sumIQ / n - meanI * meanQ;
+    auto dbfs = [](double power) { return 10 * std::log10(std::max(power, 1e-20)); };
+
+    measurement.valid = true;
+    measurement.powerDbfs = dbfs((window.sumII + window.sumQQ) / n);
+    measurement.peakDbfs = dbfs(window.peak);
+    measurement.dc = std::complex<float>(static_cast<float>(meanI), static_cast<float>(meanQ));
+    measurement.imbalanceDb = (varI > 0 && varQ > 0) ? 10 * std::log10(varI / varQ) : 0;
+    measurement.phaseDeg = (varI > 0 && varQ > 0)
+        ? std::asin(std::clamp(covariance / std::sqrt(varI * varQ), -1.0, 1.0)) * 180 / M_PI : 0;
+    window = Convert::Levels{};
+    return true;
+}
+
+LevelMeter::Measurement LevelMeter::last() const {
+    std::unique_lock lock(mutex);
+    return measurement;
+}
+
+void LevelMeter::reset() {
+    clipCount = 0;
+    std::unique_lock lock(mutex);
+    window = Convert::Levels{};
+    measurement = Measurement{};
+}
+
+WaitStrategy parseWaitStrategy(const std::string &name) {
+    if (name == "spin")
+        return WaitStrategy::Spin;
+    if (name == "hybrid")
+        return WaitStrategy::Hybrid;
+    if (name == "block")
+        return WaitStrategy::Block;
+    throw std::runtime_error("invalid wait strategy '" + name + "' -- use spin, hybrid or block");
+}
+
+BackPressure parseBackPressure(const std::string &name) {
+    if (name == "block")
+        return BackPressure::Block;
+    if (name == "drop_newest")
+        return BackPressure::DropNewest;
+    if (name == "drop_oldest")
+        return BackPressure::DropOldest;
+    if (name == "grow")
+        return BackPressure::Grow;
+    throw std::runtime_error("invalid backpressure '" + name + "' -- use block, drop_newest, drop_oldest or grow");
+}
+
+PoolMemory PoolMemory::fromArgs(const SoapySDR::Kwargs &args, PoolMemory defaults) {
+    if (args.count("prefault") > 0)
+        defaults.prefault = args.at("prefault") == "true";
+    if (args.count("mlock") > 0)
+        defaults.lock = args.at("mlock") == "true";
+    return defaults;
+}
+
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 void Connector::pushData(std::unique_ptr<Frame> &&frame) {
     //SoapySDR_log(SOAPY_SDR_INFO, "pushToForward");
+    frame->header().pushedNs = ConnectorStats::nowNs();
+    if (SpectrumMonitor *monitor = spectrum.load(std::memory_order_acquire))
+        monitor->tap(*frame);
     std::unique_lock lock(mutex);
+    if (frame->header().generation != generation) {
+        // acquired before the pool was reconfigured, the data belongs to the previous activation
+        SoapySDR_log(SOAPY_SDR_DEBUG, "Connector::pushData dropping frame of a previous generation");
+        recycleLocked(std::move(frame));
+        return;
+    }
+    // only frames reaching the Rx count as transferred
+    stats.framesPushed.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesPushed.fetch_add(frame->size(), std::memory_order_relaxed);
     tx2rx.push(std::move(frame));
-    cond.notify_all();
+    dataCount.store(tx2rx.size(), std::memory_order_release);
+    dataCond.notify_one();
+    updateEventsLocked();
 }
 
 void Connector::pushEmpty(std::unique_ptr<Frame> &&frame) {
     //SoapySDR_log(SOAPY_SDR_INFO, "pushToReuse");
     std::unique_lock lock(mutex);
+    recycleLocked(std::move(frame));
+}
+
+void Connector::recycleLocked(std::unique_ptr<Frame> &&frame) {
+    FrameHeader &header = frame->header();
+    if (header.generation != generation) {
+        // frames allocated for an older pool, or beyond the current pool size, are freed
+        if (header.generation < poolBase || poolOwned > poolTarget) {
+            if (header.generation >= poolBase)
+                poolOwned--;
+            updateEventsLocked();
+            return;
+        }
+        header.generation = generation;
+    }
+    header.flags = 0;
+    frame->resize(frameSize);  // undo the Tx shrinking the frame
     rx2tx.push(std::move(frame));
-    cond.notify_all();
+    emptyCount.store(rx2tx.size(), std::memory_order_release);
+    emptyCond.notify_one();
+    updateEventsLocked();
 }
 
 void Connector::activate() {
+    std::unique_lock lock(mutex);
     doWork = true;
+    updateEventsLocked();
 }
 
 void Connector::notiffyExit() {
+    std::unique_lock lock(mutex);
     doWork = false;
-    cond.notify_all();
+    dataCond.notify_all();
+    emptyCond.notify_all();
+    updateEventsLocked();
+}
+
+#ifdef __linux__
+static int createEventFd(const char *what) {
+    const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Connector::%s eventfd failed: %s", what, strerror(errno));
+    return fd;
 }
 
-std::unique_ptr<Frame> Connector::pullEmpty(std::chrono::microseconds duration) {
+/** Keep the eventfd counter non zero exactly while ready, so the fd works level triggered */
+static void setEventLevel(int fd, bool &signalled, bool ready) {
+    if (fd < 0 || signalled == ready)
+        return;
+    eventfd_t value;
+    if (ready)
+        eventfd_write(fd, 1);
+    else
+        eventfd_read(fd, &value);
+    signalled = ready;
+}
+#endif
+
+int Connector::getDataFd() {
+#ifdef __linux__
     std::unique_lock lock(mutex);
+    if (dataFd < 0) {
+        dataFd = createEventFd("getDataFd");
+        updateEventsLocked();
+    }
+    return dataFd;
+#else
+    return -1;
+#endif
+}
 
-    if (rx2tx.empty()) {
-        cond.wait_for(lock, duration);
+int Connector::getEmptyFd() {
+#ifdef __linux__
+    std::unique_lock lock(mutex);
+    if (emptyFd < 0) {
+        emptyFd = createEventFd("getEmptyFd");
+        updateEventsLocked();
     }
+    return emptyFd;
+#else
+    return -1;
+#endif
+}
+
+void Connector::onFdClose(std::function<void(int fd)> hook) {
+    std::unique_lock lock(mutex);
+    fdCloseHooks.push_back(std::move(hook));
+}
 
-    if (rx2tx.empty()) {
-        SoapySDR_logf(SOAPY_SDR_DEBUG, "Connector::pullEmpty FAILED, is the receiver working???");
+void Connector::updateEventsLocked() {
+#ifdef __linux__
+    if (dataFd < 0 && emptyFd < 0)
+        return;
+    const bool inactive = !doWork;
+    setEventLevel(dataFd, dataSignalled, inactive || !tx2rx.empty());
+    // the same conditions under which pullEmpty hands out a frame without waiting
+    const bool canPull = !rx2tx.empty() || poolOwned < poolTarget
+        || (backPressure == BackPressure::Grow && poolOwned < growLimit)
+        || (backPressure == BackPressure::DropOldest && !tx2rx.empty());
+    setEventLevel(emptyFd, emptySignalled, inactive || canPull);
+#endif
+}
+
+Connector::Connector(const std::string &name): name(name) {
+}
+
+SpectrumMonitor &Connector::getSpectrum(size_t size, const ThreadConfig &threads) {
+    std::unique_lock lock(mutex);
+    if (!spectrumOwner) {
+        spectrumOwner = std::make_unique<SpectrumMonitor>(size, threads);
+        spectrum.store(spectrumOwner.get(), std::memory_order_release);
+    }
+    return *spectrumOwner;
+}
+
+Connector::~Connector() {
+#ifdef __linux__
+    for (const auto &hook : fdCloseHooks) {
+        if (dataFd >= 0)
+            hook(dataFd);
+        if (emptyFd >= 0)
+            hook(emptyFd);
+    }
+    if (dataFd >= 0)
+        close(dataFd);
+    if (emptyFd >= 0)
+        close(emptyFd);
+#endif
+}
+
+/**
+ * Wait until count is non zero or the pipe is deactivated.
+ * Called without the lock, returns with the lock held.
+ * The predicate is evaluated under the lock so a push between the check and the wait is never missed.
+ */
+bool Connector::waitReady(std::unique_lock<std::mutex> &lock, std::condition_variable &cond, const std::atomic<size_t> &count,
+    std::chrono::microseconds duration, WaitStrategy strategy, Histogram &waitStats, const char *traceName) {
+    auto ready = [&]() { return count.load(std::memory_order_acquire) > 0 || !doWork; };
+
+    lock.lock();
+    if (ready())
+        return true;
+    if (duration == POLL)
+        return false;
+    lock.unlock();
+
+    LOOPBACK_TRACE_SCOPE(traceName);
+    const auto start = std::chrono::steady_clock::now();
+    const bool timed = duration != UNTIMED;
+    const auto deadline = timed ? start + duration : std::chrono::steady_clock::time_point::max();
+
+    if (strategy != WaitStrategy::Block) {
+        const auto spinUntil = (strategy == WaitStrategy::Spin) ? deadline : std::min(deadline, start + HYBRID_SPIN);
+        while (!ready() && std::chrono::steady_clock::now() < spinUntil) {
+            cpuRelax();
+        }
+    }
+
+    lock.lock();
+    bool result = ready();
+    if (!result && strategy != WaitStrategy::Spin) {
+        if (timed) {
+            result = cond.wait_until(lock, deadline, ready);
+        } else {
+            cond.wait(lock, ready);
+            result = true;
+        }
+    }
+    waitStats.record(std::chrono::steady_clock::now() - start);
+    return result;
+}
+
+std::unique_ptr<Frame> Connector::pullEmpty(std::chrono::microseconds duration, WaitStrategy strategy) {
+    std::unique_lock lock(mutex, std::defer_lock);
+
+    if (emptyCount.load(std::memory_order_relaxed) == 0) {
+        lock.lock();
+        if (rx2tx.empty() && backPressure == BackPressure::Grow && poolOwned >= poolTarget && poolOwned < growLimit) {
+            // the pool keeps the extra frame until the next FillEmpty
+            poolTarget = poolOwned + 1;
+            stats.grownFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (rx2tx.empty() && poolOwned < poolTarget) {
+            // first use of this pool slot, carve it from the slab; only the header is touched here
+            poolOwned++;
+            FrameHeader *header = slab ? slab->carve(frameSize) : nullptr;
+            auto frame = header ? std::make_unique<Frame>(slab, header) : std::make_unique<Frame>(frameSize);
+            frame->header().generation = generation;
+            updateEventsLocked();
+            return frame;
+        }
+        if (rx2tx.empty() && backPressure == BackPressure::DropOldest && !tx2rx.empty()) {
+            // overwrite the oldest frame the Rx did not pick up yet
+            std::unique_ptr<Frame> frame = std::move(tx2rx.front());
+            tx2rx.pop();
+            dataCount.store(tx2rx.size(), std::memory_order_release);
+            stats.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            stats.droppedBytes.fetch_add(frame->size(), std::memory_order_relaxed);
+            frame->header().flags = 0;
+            frame->resize(frameSize);
+            updateEventsLocked();
+            return frame;
+        }
+        if (rx2tx.empty() && backPressure == BackPressure::DropNewest)
+            return {};
+        lock.unlock();
+    }
+
+    if (!waitReady(lock, emptyCond, emptyCount, duration, strategy, stats.waitEmpty, "Connector::waitEmpty") || rx2tx.empty()) {
+        if (doWork && duration != POLL) {
+            stats.overflows.fetch_add(1, std::memory_order_relaxed);
+            SoapySDR_logf(SOAPY_SDR_DEBUG, "Connector::pullEmpty FAILED, is the receiver working???");
+        }
         return {};
     }
 
     std::unique_ptr<Frame> result = std::move(rx2tx.front());
     //SoapySDR_logf(SOAPY_SDR_INFO, "pullEmptyFrame rx_size = %d * %d", rx2tx.size(), result->data.size());    
     rx2tx.pop();
+    emptyCount.store(rx2tx.size(), std::memory_order_relaxed);
+    updateEventsLocked();
     return result;
 }
 
-std::unique_ptr<Frame> Connector::pullData(std::chrono::microseconds duration) {
-    std::unique_lock lock(mutex);
-    if (doWork && tx2rx.empty()) {
-        cond.wait_for(lock, duration);
-    }
-    if (!doWork || tx2rx.empty()) {
+std::unique_ptr<Frame> Connector::pullData(std::chrono::microseconds duration, WaitStrategy strategy) {
+    std::unique_lock lock(mutex, std::defer_lock);
+
+    if (!waitReady(lock, dataCond, dataCount, duration, strategy, stats.waitData, "Connector::waitData") || !doWork || tx2rx.empty()) {
+        if (doWork && duration != POLL)
+            stats.underflows.fetch_add(1, std::memory_order_relaxed);
         return {};
     }
     std::unique_ptr<Frame> result = std::move(tx2rx.front());
     //SoapySDR_logf(SOAPY_SDR_INFO, "pullRxData tx_size = %d * %d", tx2rx.size(), result->data.size());    
     tx2rx.pop();
+    dataCount.store(tx2rx.size(), std::memory_order_relaxed);
+    updateEventsLocked();
+    lock.unlock();
+
+    stats.framesPulled.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesPulled.fetch_add(result->size(), std::memory_order_relaxed);
+    stats.latency.record(std::chrono::nanoseconds(ConnectorStats::nowNs() - result->header().pushedNs));
     return result;
 }
 
-std::map<std::string, std::shared_ptr<Connector>> Connector::connectors;
-std::mutex Connector::cr_mutex;
+void Connector::prefetchData(size_t bytes) {
+    if (dataCount.load(std::memory_order_relaxed) == 0)
+        return;
+    std::unique_lock lock(mutex);
+    if (tx2rx.empty())
+        return;
+    const Frame &next = *tx2rx.front();
+    Convert::prefetch(&next.header(), std::min(next.wireSize(), sizeof(FrameHeader) + bytes));
+}
 
-std::shared_ptr<Connector> Connector::getConnector(std::string name) {
-    std::unique_lock lock(cr_mutex);
-    if (connectors.count(name) == 0) {
-        SoapySDR_logf(SOAPY_SDR_INFO, "create connector \"%s\"", name.c_str());
-        connectors[name] = std::make_shared<Connector>();
-    } else {
-        SoapySDR_logf(SOAPY_SDR_INFO, "Using existing connector \"%s\"", name.c_str());
+size_t Connector::dataDepth() {
+    std::unique_lock lock(mutex);
+    return tx2rx.size();
+}
+
+size_t Connector::emptyDepth() {
+    std::unique_lock lock(mutex);
+    return rx2tx.size();
+}
+
+Connector::RegistryShard *Connector::registryShards() {
+    // never destroyed, pipes may be released by streams outliving static destruction
+    static RegistryShard *shards = new RegistryShard[REGISTRY_SHARDS];
+    return shards;
+}
+
+Connector::RegistryShard &Connector::registryShard(const std::string &name) {
+    return registryShards()[std::hash<std::string>{}(name) % REGISTRY_SHARDS];
+}
+
+std::shared_ptr<Connector> Connector::getConnector(const std::string &name) {
+    RegistryShard &shard = registryShard(name);
+    {
+        std::shared_lock lock(shard.mutex);
+        auto it = shard.connectors.find(name);
+        if (it != shard.connectors.end()) {
+            if (auto connector = it->second.lock()) {
+                SoapySDR_logf(SOAPY_SDR_DEBUG, "Using existing connector \"%s\"", name.c_str());
+                return connector;
+            }
+        }
     }
-    return connectors[name];
+
+    std::unique_lock lock(shard.mutex);
+    std::weak_ptr<Connector> &entry = shard.connectors[name];
+    if (auto connector = entry.lock())
+        return connector;
+
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "create connector \"%s\"", name.c_str());
+    std::shared_ptr<Connector> connector(new Connector(name), &Connector::release);
+    entry = connector;
+    return connector;
 }
 
-void Connector::FillEmpty(int noOfBuffers, size_t bufferSize) {
-    SoapySDR_logf(SOAPY_SDR_INFO, "Connector::FillEmpty(%d, %d)", noOfBuffers, bufferSize);
-    while (rx2tx.size() > 0) {
+void Connector::release(Connector *connector) {
+    {
+        RegistryShard &shard = registryShard(connector->name);
+        std::unique_lock lock(shard.mutex);
+        auto it = shard.connectors.find(connector->name);
+        // the name may already be taken by a new pipe created after the last reference dropped
+        if (it != shard.connectors.end() && it->second.expired())
+            shard.connectors.erase(it);
+    }
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "release connector \"%s\"", connector->name.c_str());
+    delete connector;
+}
+
+size_t Connector::registrySize() {
+    size_t result = 0;
+    RegistryShard *shards = registryShards();
+    for (size_t i = 0; i < REGISTRY_SHARDS; i++) {
+        std::shared_lock lock(shards[i].mutex);
+        result += shards[i].connectors.size();
+    }
+    return result;
+}
+
+void Connector::FillEmpty(int noOfBuffers, size_t bufferSize, PoolMemory memory) {
+    std::unique_lock lock(mutex);
+
+    generation++;
+    size_t reused = 0;
+    if (bufferSize != frameSize) {
+        // new frame size: drop the queued frames, frames held by Tx/Rx are freed when they come back
+        std::queue<std::unique_ptr<Frame>>().swap(tx2rx);
+        std::queue<std::unique_ptr<Frame>>().swap(rx2tx);
+        frameSize = bufferSize;
+        poolBase = generation;
+        poolOwned = 0;
+    } else {
+        // same size: flush undelivered data back to the pool and keep every frame
+        while (!tx2rx.empty()) {
+            rx2tx.push(std::move(tx2rx.front()));
+            tx2rx.pop();
+        }
+        std::queue<std::unique_ptr<Frame>> queued;
+        queued.swap(rx2tx);
+        while (!queued.empty()) {
+            queued.front()->header().generation = generation;
+            queued.front()->header().flags = 0;
+            queued.front()->resize(frameSize);
+            rx2tx.push(std::move(queued.front()));
+            queued.pop();
+        }
+        reused = rx2tx.size();
+    }
+    poolTarget = noOfBuffers > 0 ? noOfBuffers : 0;
+
+    // missing frames are carved lazily by pullEmpty, reserve one slab for all of them
+    while (poolOwned > poolTarget && !rx2tx.empty()) {
         rx2tx.pop();
+        poolOwned--;
     }
-    while (noOfBuffers-- > 0) {
-        rx2tx.push(std::move(std::make_unique<Frame>(bufferSize)));
+    const size_t missing = poolTarget > poolOwned ? poolTarget - poolOwned : 0;
+    if (missing > 0 && (!slab || slab->remaining() < missing * FrameSlab::slotSize(frameSize)))
+        slab = std::make_shared<FrameSlab>(missing * FrameSlab::slotSize(frameSize));
+
+    // only a newly built slab is faulted in, the next activation reuses the resident pool
+    if (slab && (memory.prefault || memory.lock) && (!slab->isPrefaulted() || (memory.lock && !slab->isLocked()))) {
+        const auto start = std::chrono::steady_clock::now();
+        slab->prefault();
+        if (memory.lock && !slab->isLocked() && !slab->lock())
+            SoapySDR_logf(SOAPY_SDR_WARNING, "Connector::FillEmpty %s: mlock of %zu bytes failed: %s, check RLIMIT_MEMLOCK",
+                name.c_str(), slab->size(), strerror(errno));
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        stats.prefaultUs.store(us, std::memory_order_relaxed);
+        stats.lockedBytes.store(slab->isLocked() ? slab->size() : 0, std::memory_order_relaxed);
+        SoapySDR_logf(SOAPY_SDR_DEBUG, "Connector::FillEmpty %s: %zu byte pool faulted in%s in %lld us",
+            name.c_str(), slab->size(), slab->isLocked() ? " and locked" : "", (long long) us);
     }
+
+    dataCount.store(tx2rx.size(), std::memory_order_release);
+    emptyCount.store(rx2tx.size(), std::memory_order_release);
+    emptyCond.notify_all();
+    updateEventsLocked();
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Connector::FillEmpty(%d, %zu) generation %llu, reused %zu frames",
+        noOfBuffers, bufferSize, (unsigned long long) generation, reused);
+}
+
+void Connector::setBackPressure(BackPressure policy, size_t limit) {
+    std::unique_lock lock(mutex);
+    backPressure = policy;
+    growLimit = limit;
+    updateEventsLocked();
+}
+
+void Connector::recordDrop(size_t bytes) {
+    stats.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+    stats.droppedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+size_t Connector::poolSize() {
+    std::unique_lock lock(mutex);
+    return poolOwned;
+}
+
+uint64_t Connector::currentGeneration() {
+    std::unique_lock lock(mutex);
+    return generation;
 }
 
 namespace SoapySDR {
     Stream::Stream() {
         SoapySDR_logf(SOAPY_SDR_INFO, "Stream::Stream()");
     }
+
+    Stream::~Stream() = default;
 }
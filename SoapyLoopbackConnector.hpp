@@ -1,35 +1,313 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
-#include <map>
+#include <cstdint>
+#include <functional>
 #include <mutex>
 #include <memory>
 #include <queue>
+#include <shared_mutex>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include <SoapySDR/Constants.h>
 #include <SoapySDR/Logger.hpp>
+#include <SoapySDR/Types.hpp>
 
-struct Frame
-{
-    unsigned long long tick;
-    std::vector<signed char> data;
+#include "SoapyLoopbackConvert.hpp"
+#include "SoapyLoopbackThread.hpp"
 
-    Frame(size_t size) {
-      data.resize(size);
-    }
+class Medium;
+class MediumPort;
+class NullSink;
+class OrderedStage;
+class ScenarioPlayer;
+class SignalGenerator;
+class SpectrumMonitor;
+
+/**
+ * Metadata of a frame, stored right in front of its payload in the same slab. It is plain
+ * old data with fixed width fields, so header and payload can be written to a file or a
+ * socket, or mapped by another process, as one contiguous block.
+ */
+struct FrameHeader {
+    static constexpr uint32_t MAGIC = 0x3146424c;  ///< "LBF1"
+
+    enum Flags : uint32_t {
+        INTEGRITY = 1 << 0,     ///< sequence and crc are valid, see Integrity::stamp
+        HAS_TIME  = 1 << 1,     ///< the Tx gave a timestamp for tick
+        END_BURST = 1 << 2,     ///< last frame of a Tx burst
+    };
+
+    uint32_t magic;
+    uint16_t headerSize;        ///< sizeof(FrameHeader), the payload starts here
+    uint8_t format;             ///< Convert::Format of the samples
+    uint8_t channels;
+    uint32_t flags;
+    uint32_t crc;
+    uint64_t capacity;          ///< payload bytes available in the slab
+    uint64_t length;            ///< valid payload bytes
+    uint64_t sequence;
+    int64_t tick;               ///< sample tick of the first sample, set by the Tx
+    uint64_t generation;        ///< pool generation the frame was last handed out in
+    int64_t pushedNs;           ///< steady clock time of pushData, for the latency histogram
 };
 
+static_assert(sizeof(FrameHeader) == 64, "FrameHeader is one cache line");
+static_assert(std::is_standard_layout_v<FrameHeader> && std::is_trivially_copyable_v<FrameHeader>,
+    "FrameHeader must stay POD");
+
+/**
+ * One cache line aligned allocation frames are carved from. Each frame takes a header
+ * and its payload rounded up to a cache line, sizes may differ between frames. The slab
+ * is freed when the last frame carved from it is gone.
+ */
+class FrameSlab {
+  public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    explicit FrameSlab(size_t bytes);
+    ~FrameSlab();
+    FrameSlab(const FrameSlab &) = delete;
+    FrameSlab &operator=(const FrameSlab &) = delete;
+
+    /** Bytes a frame with the given payload capacity takes in a slab */
+    static size_t slotSize(size_t payloadBytes);
+
+    /** Carve a frame, nullptr when the slab is full. Not thread safe, the owner serializes. */
+    FrameHeader *carve(size_t payloadBytes);
+
+    size_t size() const { return bytes; }
+    size_t remaining() const { return bytes - offset; }
+    unsigned char *data() { return base; }
+
+    /** Fault in the part not carved yet, so carving never page faults. Only the first call does work. */
+    void prefault();
+    bool isPrefaulted() const { return prefaulted; }
+
+    /** mlock the whole slab, false when the memlock limit does not allow it */
+    bool lock();
+    bool isLocked() const { return locked; }
+
+  private:
+    unsigned char *base;
+    size_t bytes;
+    size_t offset {0};
+    bool locked {false};
+    bool prefaulted {false};
+};
+
+/** Handle of a frame living in a slab, moved between the queues of a pipe */
+class Frame {
+  public:
+    /** Standalone frame in a slab of its own */
+    explicit Frame(size_t capacity);
+    Frame(std::shared_ptr<FrameSlab> slab, FrameHeader *header);
+    Frame(const Frame &) = delete;
+    Frame &operator=(const Frame &) = delete;
+
+    FrameHeader &header() { return *hdr; }
+    const FrameHeader &header() const { return *hdr; }
+
+    char *payload() { return reinterpret_cast<char *>(hdr) + sizeof(FrameHeader); }
+    const char *payload() const { return reinterpret_cast<const char *>(hdr) + sizeof(FrameHeader); }
+    size_t size() const { return hdr->length; }
+    size_t capacity() const { return hdr->capacity; }
+
+    /** Set the valid payload length, clamped to the capacity */
+    void resize(size_t bytes) { hdr->length = bytes < hdr->capacity ? bytes : hdr->capacity; }
+
+    /** Header followed by the valid payload, ready for write() or send() */
+    const void *wire() const { return hdr; }
+    size_t wireSize() const { return sizeof(FrameHeader) + hdr->length; }
+
+  private:
+    std::shared_ptr<FrameSlab> slab;
+    FrameHeader *hdr;
+};
+
+/**
+ * Log2 histogram of durations in microseconds, bucket i holds [2^(i-1), 2^i) us.
+ * Only relaxed atomics are used, each histogram has a single writer thread.
+ */
+class Histogram {
+  public:
+    static constexpr size_t BUCKETS = 32;
+
+    void record(std::chrono::nanoseconds duration);
+    /** Upper bound in microseconds of the bucket holding the given percentile (0..100) */
+    unsigned long long percentile(double p) const;
+    unsigned long long count() const;
+    void reset();
+
+  private:
+    std::atomic<unsigned long long> buckets[BUCKETS] {};
+};
+
+/**
+ * Per pipe telemetry. Tx thread is the only writer of the push/overflow counters,
+ * Rx thread is the only writer of the pull/underflow counters.
+ */
+struct ConnectorStats {
+    std::atomic<unsigned long long> framesPushed{0};
+    std::atomic<unsigned long long> bytesPushed{0};
+    std::atomic<unsigned long long> framesPulled{0};
+    std::atomic<unsigned long long> bytesPulled{0};
+    std::atomic<unsigned long long> overflows{0};   ///< Tx timed out waiting for an empty frame
+    std::atomic<unsigned long long> underflows{0};  ///< Rx timed out waiting for data
+    std::atomic<unsigned long long> droppedFrames{0};  ///< frames discarded by the back-pressure policy
+    std::atomic<unsigned long long> droppedBytes{0};
+    std::atomic<unsigned long long> grownFrames{0};    ///< frames added to the pool by backpressure=grow
+    std::atomic<unsigned long long> prefaultUs{0};     ///< time the last FillEmpty spent faulting in the pool, kept by reset()
+    std::atomic<unsigned long long> lockedBytes{0};    ///< pool slab bytes mlocked, kept by reset()
+    Histogram waitEmpty;                            ///< time blocked in pullEmpty
+    Histogram waitData;                             ///< time blocked in pullData
+    Histogram latency;                              ///< pushData -> pullData frame latency
+    std::atomic<long long> sinceNs{nowNs()};        ///< steady clock of the last reset
+    std::atomic<unsigned long long> integrityChecked{0};
+    std::atomic<unsigned long long> integrityCrcErrors{0};
+    std::atomic<unsigned long long> integrityLost{0};
+    std::atomic<unsigned long long> integrityDuplicated{0};
+
+    void reset();
+    /** Average rate of the pushed samples since the last reset */
+    double pushedMsps(size_t itemSize) const;
+    static long long nowNs();
+};
+
+/**
+ * Rx signal levels, measured by readStream while a level sensor is read, digital_agc or
+ * the automatic DC offset correction is on. The Rx thread adds the statistics of every
+ * copy and publishes a measurement every WINDOW samples, the clip count is cumulative.
+ */
+class LevelMeter {
+  public:
+    static constexpr uint64_t WINDOW = 65536;
+
+    struct Measurement {
+        bool valid {false};
+        double powerDbfs {-200};
+        double peakDbfs {-200};
+        std::complex<float> dc {};
+        double imbalanceDb {0};   ///< I power over Q power
+        double phaseDeg {0};      ///< deviation from quadrature
+    };
+
+    /** Rx thread, returns true when the copy completed a window */
+    bool add(const Convert::Levels &levels);
+
+    Measurement last() const;
+    unsigned long long clipped() const { return clipCount.load(std::memory_order_relaxed); }
+    void reset();
+
+    /** Set by reading a level sensor, the meter keeps measuring from then on */
+    mutable std::atomic<bool> armed {false};
+
+  private:
+    mutable std::mutex mutex;
+    Convert::Levels window;
+    Measurement measurement;
+    std::atomic<unsigned long long> clipCount {0};
+};
+
+/**
+ * How a stream waits for frames in pullData/pullEmpty.
+ * Spin busy-polls until the timeout (for threads pinned to isolated cores),
+ * Hybrid busy-polls for up to HYBRID_SPIN and then blocks, Block sleeps on a condition variable.
+ */
+enum class WaitStrategy {
+    Spin,
+    Hybrid,
+    Block
+};
+
+WaitStrategy parseWaitStrategy(const std::string &name);
+
+/**
+ * What the Tx does when the Rx falls behind and no empty frame is left.
+ *
+ * Block waits for up to the writeStream/acquireWriteBuffer timeout and returns SOAPY_SDR_TIMEOUT,
+ * DropNewest lets the Tx write into a discard frame, DropOldest recycles the oldest frame queued
+ * for the Rx (ring buffer), Grow adds frames to the pool up to a cap and then blocks.
+ */
+enum class BackPressure {
+    Block,
+    DropNewest,
+    DropOldest,
+    Grow
+};
+
+BackPressure parseBackPressure(const std::string &name);
+
+/**
+ * How FillEmpty backs a new pool. Faulting the slab in when FillEmpty builds it moves the page
+ * faults of the first pass through the frames from the streaming loop to activateStream. A
+ * pool reused by the next activation is already resident and costs nothing.
+ */
+struct PoolMemory {
+    bool prefault {true};  ///< fault in every page of a newly built slab
+    bool lock {false};     ///< mlock the slab, it is prefaulted as well
+
+    /** prefault and mlock stream or device args, unset keys keep the defaults */
+    static PoolMemory fromArgs(const SoapySDR::Kwargs &args, PoolMemory defaults);
+};
+
+/**
+ * Tx -> Rx pipe with a recycled pool of frames, carved on first use from one slab per pool.
+ *
+ * Every FillEmpty starts a new pool generation under the mutex. Frames queued in
+ * tx2rx are flushed back to the empty queue, and frames of matching size are
+ * reused instead of reallocated. Frames still held by either side when the
+ * generation changes are retagged when they come back if they fit the pool,
+ * and freed otherwise. Data pushed from an older generation is never delivered
+ * to the Rx.
+ */
 class Connector {
   private:
     std::queue<std::unique_ptr<Frame>> tx2rx;
     std::queue<std::unique_ptr<Frame>> rx2tx;
     std::mutex mutex;
-    std::condition_variable cond;
+    std::condition_variable dataCond;
+    std::condition_variable emptyCond;
     std::atomic<bool> doWork{true};
+    std::atomic<size_t> dataCount{0};   ///< tx2rx.size() mirrored for lock-free polling
+    std::atomic<size_t> emptyCount{0};  ///< rx2tx.size() mirrored for lock-free polling
+    ConnectorStats stats;
+
+    uint64_t generation {0};   ///< incremented by every FillEmpty
+    uint64_t poolBase {0};     ///< generation the current frames were allocated in
+    std::shared_ptr<FrameSlab> slab;  ///< frames of the pool are carved from here on first use
+    size_t frameSize {0};
+    size_t poolTarget {0};     ///< number of frames wanted in the pool
+    size_t poolOwned {0};      ///< frames of the current pool alive, queued or held by Tx/Rx
+    BackPressure backPressure {BackPressure::Block};
+    size_t growLimit {0};      ///< pool size backpressure=grow stops at
+    int dataFd {-1};           ///< eventfd readable while tx2rx holds a frame or the pipe is inactive
+    int emptyFd {-1};          ///< eventfd readable while pullEmpty hands out a frame at once or the pipe is inactive
+    bool dataSignalled {false};
+    bool emptySignalled {false};
+    std::vector<std::function<void(int)>> fdCloseHooks;
+    std::unique_ptr<SpectrumMonitor> spectrumOwner;
+    std::atomic<SpectrumMonitor *> spectrum {nullptr};  ///< tapped by pushData once created
+
+    void recycleLocked(std::unique_ptr<Frame> &&frame);
+    void updateEventsLocked();
+
+    bool waitReady(std::unique_lock<std::mutex> &lock, std::condition_variable &cond, const std::atomic<size_t> &count,
+        std::chrono::microseconds duration, WaitStrategy strategy, Histogram &waitStats, const char *traceName);
 
   public:
-    void FillEmpty(int noOfBuffers, size_t bufferSize);
+    static constexpr std::chrono::microseconds HYBRID_SPIN{50};
+    /** Duration for pullData/pullEmpty waiting until a frame arrives or the pipe is deactivated */
+    static constexpr std::chrono::microseconds UNTIMED = std::chrono::microseconds::max();
+    /** Duration for pullData/pullEmpty returning at once, a poll finding nothing is not counted as a stall */
+    static constexpr std::chrono::microseconds POLL {0};
+
+    void FillEmpty(int noOfBuffers, size_t bufferSize, PoolMemory memory = {});
 
     void pushData(std::unique_ptr<Frame> &&frame);
     void pushEmpty(std::unique_ptr<Frame> &&frame);
@@ -38,25 +316,121 @@ class Connector {
     bool isActive() { return doWork; }
     void notiffyExit();
 
-    std::unique_ptr<Frame> pullEmpty(std::chrono::microseconds duration);
-    std::unique_ptr<Frame> pullData(std::chrono::microseconds duration);
+    void setBackPressure(BackPressure policy, size_t limit);
+    BackPressure getBackPressure() { return backPressure; }
+    /** Account a frame the Tx wrote into a discard frame */
+    void recordDrop(size_t bytes);
+    size_t poolSize();
+
+    /**
+     * Lazily allocates frames until the pool reaches the FillEmpty size, then applies the
+     * back-pressure policy and waits for recycled ones. DropNewest returns nullptr at once.
+     */
+    std::unique_ptr<Frame> pullEmpty(std::chrono::microseconds duration, WaitStrategy strategy = WaitStrategy::Block);
+    std::unique_ptr<Frame> pullData(std::chrono::microseconds duration, WaitStrategy strategy = WaitStrategy::Block);
+
+    /** Hint the header and the first bytes of the next data frame into the cache */
+    void prefetchData(size_t bytes);
+
+    uint64_t currentGeneration();
+    size_t dataDepth();
+    size_t emptyDepth();
+    ConnectorStats &getStats() { return stats; }
+
+    /**
+     * Pollable eventfds for multiplexing pipes with epoll instead of blocking a thread per
+     * stream. They are level triggered: the data fd is readable while a frame waits for the
+     * Rx, the empty fd while the Tx gets a frame without waiting, both while the pipe is
+     * deactivated. Users never read them, pulling the frames clears them. Created on the
+     * first call, -1 where eventfd is not available.
+     */
+    int getDataFd();
+    int getEmptyFd();
+
+    /** Call hook with each eventfd right before the destructor closes it, so pollers can forget the fd */
+    void onFdClose(std::function<void(int fd)> hook);
+
+    /** Spectrum monitor of the pipe, started with the given FFT size and thread placement on the first call */
+    SpectrumMonitor &getSpectrum(size_t size, const ThreadConfig &threads);
+
+    explicit Connector(const std::string &name);
+    ~Connector();
 
-    static std::map<std::string, std::shared_ptr<Connector>> connectors;
-    static std::shared_ptr<Connector> getConnector(std::string name);
+    const std::string &getName() const { return name; }
 
-    static std::mutex cr_mutex;
+    /**
+     * Find or create the named pipe. The registry only keeps weak references,
+     * the pipe and its frames are freed when the last stream using it closes.
+     */
+    static std::shared_ptr<Connector> getConnector(const std::string &name);
+
+    /** Number of pipes currently alive */
+    static size_t registrySize();
+
+  private:
+    const std::string name;
+
+    struct RegistryShard {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, std::weak_ptr<Connector>> connectors;
+    };
+
+    static constexpr size_t REGISTRY_SHARDS = 16;
+    static RegistryShard *registryShards();
+    static RegistryShard &registryShard(const std::string &name);
+    static void release(Connector *connector);
 };
 
 
+/** Frame currently held by the user between acquire*Buffer and release*Buffer */
+struct AcquiredFrame {
+    std::unique_ptr<Frame> frame;
+    Convert::Format format {Convert::Format::Unknown};   ///< sample format of the frame, the Tx format for pipes
+    size_t bufferedElems {0};
+    char *currentBuff {nullptr};
+};
+
 namespace SoapySDR {
 
+    /** Per stream state, allocated by setupStream and freed by closeStream */
     class Stream {
       public:
         Stream();
+        ~Stream();
         std::shared_ptr<Connector> pipe {};
+        std::unique_ptr<SignalGenerator> generator {};  ///< set instead of pipe for pipe=gen:...
+        std::unique_ptr<NullSink> nullSink {};          ///< set instead of pipe for pipe=null
+        std::shared_ptr<Medium> medium {};              ///< set instead of pipe for pipe=medium:...
+        std::shared_ptr<MediumPort> mediumPort {};
+        std::unique_ptr<Frame> localFrame {};           ///< frame owned by the stream when there is no pool
+        std::unique_ptr<OrderedStage> stage {};         ///< Tx frame processing on the worker pool, dsp_pool=true
         int itemSize {0};
         int bufferSize {0};
         int noOfBuffers {0};
         std::string pipeName{"default"};
+        WaitStrategy wait {WaitStrategy::Block};
+        ThreadConfig threads {};
+        std::string format {};
+        Convert::Format formatId {Convert::Format::Unknown};
+        SoapySDR::Kwargs args {};
+        bool integrity {false};                         ///< Tx stamps frames with sequence and CRC32C
+        uint64_t sequence {0};                          ///< Tx: next sequence to stamp, Rx: next sequence expected
+        int direction {SOAPY_SDR_RX};
+        BackPressure backPressure {BackPressure::Block};
+        size_t growMax {0};                             ///< backpressure=grow pool cap in frames
+        PoolMemory poolMemory {};                       ///< Tx: prefault and mlock of the pipe pool
+        bool discarding {false};                        ///< the acquired Tx frame is the drop_newest discard frame
+        Convert::CopyOptions copy {};                   ///< Rx readStream conversion, iq_swap, scale and nt_threshold
+        std::vector<char> converted {};                 ///< Rx acquireReadBuffer: frame converted to the stream format
+        LevelMeter levels {};                           ///< Rx signal statistics
+        std::atomic<float> agcGainDb {0};               ///< digital_agc gain applied by readStream
+        std::complex<float> dcOffset {};                ///< DC removed by readStream with the automatic DC offset mode
+        std::unique_ptr<ScenarioPlayer> scenario {};    ///< Tx channel scenario, see writeSetting("scenario")
+        uint64_t scenarioVersion {0};                   ///< device scenario the player was created for
+
+        AcquiredFrame aquired {};
+        std::atomic<bool> reset {false};
+        std::atomic<bool> overflow {false};
+        long long ticks {0};                            ///< tick of the next sample the stream writes or reads
     };
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include "SoapyLoopbackConvert.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <SoapySDR/Formats.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Convert {
+
+namespace {
+
+template <typename T>
+inline T saturate(float v, float scale) {
+    // round half away from zero without lrintf so the conversion loops vectorize
+    const float x = std::clamp(v * scale, -scale - 1.0f, scale);
+    return static_cast<T>(static_cast<int32_t>(x + std::copysign(0.5f, x)));
+}
+
+inline int16_t signExtend12(unsigned v) {
+    return static_cast<int16_t>(static_cast<int16_t>(v << 4) >> 4);
+}
+
+// samples per block of the fused copy, the float block and its output stay in L1
+constexpr size_t COPY_BLOCK = 512;
+// how far ahead of the block being converted the source is prefetched
+constexpr size_t PREFETCH_AHEAD = 4096;
+constexpr size_t CACHE_LINE = 64;
+
+/** memcpy with non-temporal stores, the caller fences once the whole copy is done */
+void streamCopy(void *dst, const void *src, size_t bytes) {
+#if defined(__SSE2__)
+    char *d = static_cast<char *>(dst);
+    const char *s = static_cast<const char *>(src);
+    const size_t head = std::min<size_t>((16 - reinterpret_cast<uintptr_t>(d) % 16) % 16, bytes);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    bytes -= head;
+    for (; bytes >= 64; bytes -= 64, d += 64, s += 64) {
+        __builtin_prefetch(s + PREFETCH_AHEAD);
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 32));
+        const __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d), a);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d + 48), e);
+    }
+    memcpy(d, s, bytes);
+#else
+    memcpy(dst, src, bytes);
+#endif
+}
+
+/**
+ * Statistics of a converted block. The reductions are split over LANES independent
+ * accumulators so the compiler vectorizes them without reassociating a single sum.
+ */
+void measure(const float *iq, size_t numElems, Levels &levels) {
+    constexpr size_t LANES = 8;  // 4 complex samples
+    constexpr float CLIP = 0.999999f;  // the largest code converts to 1.0 give or take the rounding of 1/max
+    float sum[LANES] = {}, square[LANES] = {}, cross[LANES / 2] = {}, peak[LANES / 2] = {};
+    uint32_t clipped[LANES / 2] = {};
+
+    const size_t values = 2 * numElems;
+    size_t i = 0;
+    for (; i + LANES <= values; i += LANES) {
+        for (size_t k = 0; k < LANES; k++) {
+            sum[k] += iq[i + k];
+            square[k] += iq[i + k] * iq[i + k];
+        }
+        for (size_t k = 0; k < LANES / 2; k++) {
+            const float re = iq[i + 2 * k], im = iq[i + 2 * k + 1];
+            cross[k] += re * im;
+            peak[k] = std::max(peak[k], re * re + im * im);
+            clipped[k] += (std::fabs(re) >= CLIP) | (std::fabs(im) >= CLIP);
+        }
+    }
+    for (; i < values; i += 2) {
+        const float re = iq[i], im = iq[i + 1];
+        sum[0] += re;
+        sum[1] += im;
+        square[0] += re * re;
+        square[1] += im * im;
+        cross[0] += re * im;
+        peak[0] = std::max(peak[0], re * re + im * im);
+        clipped[0] += (std::fabs(re) >= CLIP) | (std::fabs(im) >= CLIP);
+    }
+
+    levels.samples += numElems;
+    for (size_t k = 0; k < LANES; k += 2) {
+        levels.sumI += sum[k];
+        levels.sumQ += sum[k + 1];
+        levels.sumII += square[k];
+        levels.sumQQ += square[k + 1];
+    }
+    for (size_t k = 0; k < LANES / 2; k++) {
+        levels.sumIQ += cross[k];
+        levels.peak = std::max(levels.peak, peak[k]);
+        levels.clipped += clipped[k];
+    }
+}
+
+void streamFence() {
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
+}
+
+}
+
+Format formatId(const std::string &format) {
+    if (format == SOAPY_SDR_CF32)
+        return Format::CF32;
+    if (format == SOAPY_SDR_CS16)
+        return Format::CS16;
+    if (format == SOAPY_SDR_CS12)
+        return Format::CS12;
+    if (format == SOAPY_SDR_CS8)
+        return Format::CS8;
+    return Format::Unknown;
+}
+
+size_t itemSize(const std::string &format) {
+    return itemSize(formatId(format));
+}
+
+size_t itemSize(Format format) {
+    switch (format) {
+    case Format::CF32: return 8;
+    case Format::CS16: return 4;
+    case Format::CS12: return 3;
+    case Format::CS8: return 2;
+    default: return 0;
+    }
+}
+
+void toFloat(const std::string &format, const void *src, std::complex<float> *dst, size_t numElems) {
+    if (formatId(format) == Format::Unknown)
+        throw std::runtime_error("Convert::toFloat unsupported format " + format);
+    toFloat(formatId(format), src, dst, numElems);
+}
+
+void toFloat(Format format, const void *src, std::complex<float> *dst, size_t numElems) {
+    float *out = reinterpret_cast<float *>(dst);
+    if (format == Format::CF32) {
+        memcpy(out, src, numElems * 8);
+    } else if (format == Format::CS16) {
+        const int16_t *in = static_cast<const int16_t *>(src);
+        for (size_t i = 0; i < 2 * numElems; i++)
+            out[i] = in[i] * (1.0f / 32767.0f);
+    } else if (format == Format::CS8) {
+        const int8_t *in = static_cast<const int8_t *>(src);
+        for (size_t i = 0; i < 2 * numElems; i++)
+            out[i] = in[i] * (1.0f / 127.0f);
+    } else if (format == Format::CS12) {
+        // 3 bytes per sample, I[7:0] | Q[3:0] I[11:8] | Q[11:4]
+        const uint8_t *in = static_cast<const uint8_t *>(src);
+        for (size_t i = 0; i < numElems; i++) {
+            const uint8_t *s = in + 3 * i;
+            out[2 * i] = signExtend12(s[0] | ((s[1] & 0x0f) << 8)) * (1.0f / 2047.0f);
+            out[2 * i + 1] = signExtend12((s[1] >> 4) | (s[2] << 4)) * (1.0f / 2047.0f);
+        }
+    } else {
+        throw std::runtime_error("Convert::toFloat unsupported format");
+    }
+}
+
+void fromFloat(const std::string &format, const std::complex<float> *src, void *dst, size_t numElems) {
+    if (formatId(format) == Format::Unknown)
+        throw std::runtime_error("Convert::fromFloat unsupported format " + format);
+    fromFloat(formatId(format), src, dst, numElems);
+}
+
+void fromFloat(Format format, const std::complex<float> *src, void *dst, size_t numElems) {
+    const float *in = reinterpret_cast<const float *>(src);
+    if (format == Format::CF32) {
+        memcpy(dst, in, numElems * 8);
+    } else if (format == Format::CS16) {
+        int16_t *out = static_cast<int16_t *>(dst);
+        for (size_t i = 0; i < 2 * numElems; i++)
+            out[i] = saturate<int16_t>(in[i], 32767.0f);
+    } else if (format == Format::CS8) {
+        int8_t *out = static_cast<int8_t *>(dst);
+        for (size_t i = 0; i < 2 * numElems; i++)
+            out[i] = saturate<int8_t>(in[i], 127.0f);
+    } else if (format == Format::CS12) {
+        uint8_t *out = static_cast<uint8_t *>(dst);
+        for (size_t i = 0; i < numElems; i++) {
+            const uint16_t si = static_cast<uint16_t>(saturate<int16_t>(in[2 * i], 2047.0f));
+            const uint16_t sq = static_cast<uint16_t>(saturate<int16_t>(in[2 * i + 1], 2047.0f));
+            out[3 * i] = static_cast<uint8_t>(si);
+            out[3 * i + 1] = static_cast<uint8_t>(((si >> 8) & 0x0f) | (sq << 4));
+            out[3 * i + 2] = static_cast<uint8_t>(sq >> 4);
+        }
+    } else {
+        throw std::runtime_error("Convert::fromFloat unsupported format");
+    }
+}
+
+void copy(Format srcFormat, const void *src, Format dstFormat, void *dst, size_t numElems, const CopyOptions &options) {
+    const size_t srcItem = itemSize(srcFormat);
+    const size_t dstItem = itemSize(dstFormat);
+    const bool streaming = options.streamingBytes > 0 && numElems * dstItem >= options.streamingBytes;
+
+    if (srcFormat == dstFormat && !options.swapIQ && options.scale == 1.0f && !options.levels && options.dcOffset == std::complex<float>()) {
+        if (streaming) {
+            streamCopy(dst, src, numElems * dstItem);
+            streamFence();
+        } else
+            memcpy(dst, src, numElems * dstItem);
+        return;
+    }
+
+    const char *in = static_cast<const char *>(src);
+    char *out = static_cast<char *>(dst);
+    alignas(CACHE_LINE) std::complex<float> block[COPY_BLOCK];
+    alignas(CACHE_LINE) char staged[COPY_BLOCK * 8];
+    for (size_t done = 0; done < numElems; ) {
+        const size_t n = std::min(COPY_BLOCK, numElems - done);
+        __builtin_prefetch(in + PREFETCH_AHEAD);
+        __builtin_prefetch(in + PREFETCH_AHEAD + CACHE_LINE);
+        toFloat(srcFormat, in, block, n);
+
+        float *iq = reinterpret_cast<float *>(block);
+        if (options.levels)
+            measure(iq, n, *options.levels);
+        if (options.dcOffset != std::complex<float>()) {
+            for (size_t i = 0; i < n; i++)
+                block[i] -= options.dcOffset;
+        }
+        if (options.swapIQ) {
+            for (size_t i = 0; i < 2 * n; i += 2)
+                std::swap(iq[i], iq[i + 1]);
+        }
+        if (options.scale != 1.0f) {
+            for (size_t i = 0; i < 2 * n; i++)
+                iq[i] *= options.scale;
+        }
+
+        if (streaming) {
+            fromFloat(dstFormat, block, staged, n);
+            streamCopy(out, staged, n * dstItem);
+        } else
+            fromFloat(dstFormat, block, out, n);
+        in += n * srcItem;
+        out += n * dstItem;
+        done += n;
+    }
+    if (streaming)
+        streamFence();
+}
+
+void Levels::add(const Levels &other) {
+    samples += other.samples;
+    clipped += other.clipped;
+    sumI += other.sumI;
+    sumQ += other.sumQ;
+    sumII += other.sumII;
+    sumQQ += other.sumQQ;
+    sumIQ += other.sumIQ;
+    peak = std::max(peak, other.peak);
+}
+
+void prefetch(const void *addr, size_t bytes) {
+    const char *p = static_cast<const char *>(addr);
+    for (size_t offset = 0; offset < bytes; offset += CACHE_LINE)
+        __builtin_prefetch(p + offset);
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * Conversion between the stream formats (CF32, CS16, CS12, CS8) and
+ * interleaved complex float scaled to +/-1.0 full scale.
+ */
+namespace Convert {
+
+    /** Stream format as stored in FrameHeader::format */
+    enum class Format : uint8_t {
+        Unknown = 0,
+        CF32,
+        CS16,
+        CS12,
+        CS8,
+    };
+
+    Format formatId(const std::string &format);
+
+    /** Bytes per complex sample of a stream format, 0 if unsupported */
+    size_t itemSize(const std::string &format);
+    size_t itemSize(Format format);
+
+    void toFloat(const std::string &format, const void *src, std::complex<float> *dst, size_t numElems);
+    void toFloat(Format format, const void *src, std::complex<float> *dst, size_t numElems);
+
+    /** Saturating conversion, rounds half away from zero */
+    void fromFloat(const std::string &format, const std::complex<float> *src, void *dst, size_t numElems);
+    void fromFloat(Format format, const std::complex<float> *src, void *dst, size_t numElems);
+
+    /** Signal statistics of the samples a copy read, before any correction, +/-1.0 full scale */
+    struct Levels {
+        uint64_t samples {0};
+        uint64_t clipped {0};   ///< samples with I or Q at or beyond full scale
+        double sumI {0};
+        double sumQ {0};
+        double sumII {0};
+        double sumQQ {0};
+        double sumIQ {0};
+        float peak {0};         ///< largest I^2 + Q^2
+
+        void add(const Levels &other);
+    };
+
+    /** What the Rx copy does besides moving the samples, from the stream args iq_swap, scale and nt_threshold */
+    struct CopyOptions {
+        bool swapIQ {false};
+        float scale {1.0f};
+        size_t streamingBytes {1 << 20};   ///< copies of at least this size bypass the cache, 0 never
+        std::complex<float> dcOffset {};   ///< subtracted before swapping and scaling
+        Levels *levels {nullptr};          ///< accumulates the statistics of the input when set
+    };
+
+    /**
+     * Fused Rx copy: converts between formats, measures levels, removes DC, swaps I/Q and
+     * scales in one pass over cache sized blocks. Large copies use non-temporal stores so the user buffer does not evict
+     * the frame pool, a plain copy between equal formats is a (streaming) memcpy.
+     */
+    void copy(Format srcFormat, const void *src, Format dstFormat, void *dst, size_t numElems, const CopyOptions &options);
+
+    /** Hint the first bytes of a buffer into the cache */
+    void prefetch(const void *addr, size_t bytes);
+}
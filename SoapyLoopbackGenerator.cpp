@@ -0,0 +1,147 @@
+#include "SoapyLoopbackGenerator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Logger.hpp>
+
+#include "SoapyLoopbackConvert.hpp"
+
+static double argOr(const SoapySDR::Kwargs &args, const std::string &key, double defaultValue) {
+    return (args.count(key) > 0) ? std::stod(args.at(key)) : defaultValue;
+}
+
+bool SignalGenerator::isGeneratorPipe(const std::string &pipeName) {
+    return pipeName.rfind(PIPE_PREFIX, 0) == 0;
+}
+
+SignalGenerator::SignalGenerator(const std::string &pipeName, const std::string &format, double sampleRate, const SoapySDR::Kwargs &args):
+    format(format),
+    cosLut(1 << LUT_BITS),
+    sinLut(1 << LUT_BITS),
+    scratch(2 * BLOCK)
+{
+    const std::string name = pipeName.substr(std::string(PIPE_PREFIX).size());
+    if (name == "tone")
+        kind = Kind::Tone;
+    else if (name == "noise")
+        kind = Kind::Noise;
+    else if (name == "chirp")
+        kind = Kind::Chirp;
+    else if (name == "qpsk")
+        kind = Kind::Qpsk;
+    else
+        throw std::runtime_error("unknown generator '" + pipeName + "' -- use gen:tone, gen:noise, gen:chirp or gen:qpsk");
+
+    if (format != SOAPY_SDR_CF32 && format != SOAPY_SDR_CS16 && format != SOAPY_SDR_CS12 && format != SOAPY_SDR_CS8)
+        throw std::runtime_error("generator does not support format " + format);
+
+    amplitude = argOr(args, "gen_amplitude", kind == Kind::Noise ? 0.25 : 0.7);
+    noise = argOr(args, "gen_noise", kind == Kind::Noise ? amplitude : 0.0);
+
+    for (size_t i = 0; i < cosLut.size(); i++) {
+        const double angle = 2.0 * M_PI * i / cosLut.size();
+        cosLut[i] = std::cos(angle);
+        sinLut[i] = std::sin(angle);
+    }
+
+    // phase increments in units of 2^-32 turns
+    const double turn = 4294967296.0 / sampleRate;
+    const double freq = argOr(args, "gen_freq", kind == Kind::Chirp ? 0.4 * sampleRate : sampleRate / 16);
+    phaseIncrement = static_cast<int64_t>(std::llround(freq * turn));
+    chirpPeriod = std::max<size_t>(2, static_cast<size_t>(argOr(args, "gen_period", 65536)));
+    chirpStart = -phaseIncrement;
+    chirpStep = 2 * phaseIncrement / static_cast<int64_t>(chirpPeriod);
+    samplesPerSymbol = std::max<size_t>(1, static_cast<size_t>(argOr(args, "gen_sps", 4)));
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "SignalGenerator %s, %s, amplitude %f, noise %f, freq %f Hz",
+        name.c_str(), format.c_str(), amplitude, noise, freq);
+}
+
+float SignalGenerator::uniform() {
+    // xorshift64*, top 24 bits mapped to [-0.5, 0.5)
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return static_cast<float>((rng * 0x2545f4914f6cdd1dull) >> 40) * (1.0f / 16777216.0f) - 0.5f;
+}
+
+void SignalGenerator::addNoise(float *iq, size_t n, float rms) {
+    // Irwin-Hall: sum of 4 uniforms has variance 1/3, per component rms / sqrt(2)
+    const float scale = rms * std::sqrt(3.0f / 2.0f);
+    for (size_t i = 0; i < 2 * n; i++) {
+        iq[i] += scale * (uniform() + uniform() + uniform() + uniform());
+    }
+}
+
+void SignalGenerator::synthesize(float *iq, size_t n) {
+    constexpr unsigned shift = 32 - LUT_BITS;
+    const float *cosTable = cosLut.data();
+    const float *sinTable = sinLut.data();
+
+    switch (kind) {
+    case Kind::Tone: {
+        uint32_t p = phase;
+        const uint32_t step = static_cast<uint32_t>(phaseIncrement);
+        for (size_t i = 0; i < n; i++) {
+            iq[2 * i] = amplitude * cosTable[p >> shift];
+            iq[2 * i + 1] = amplitude * sinTable[p >> shift];
+            p += step;
+        }
+        phase = p;
+        break;
+    }
+    case Kind::Chirp:
+        for (size_t i = 0; i < n; i++) {
+            const uint32_t step = static_cast<uint32_t>(chirpStart + chirpStep * static_cast<int64_t>(chirpPos));
+            iq[2 * i] = amplitude * cosTable[phase >> shift];
+            iq[2 * i + 1] = amplitude * sinTable[phase >> shift];
+            phase += step;
+            if (++chirpPos == chirpPeriod)
+                chirpPos = 0;
+        }
+        break;
+    case Kind::Qpsk: {
+        const float level = amplitude * static_cast<float>(M_SQRT1_2);
+        for (size_t i = 0; i < n; i++) {
+            if (symbolPos == 0) {
+                // PRBS15 (x^15 + x^14 + 1), two bits per symbol
+                int bits[2];
+                for (int &bit: bits) {
+                    bit = ((prbs >> 14) ^ (prbs >> 13)) & 1;
+                    prbs = static_cast<uint16_t>(((prbs << 1) | bit) & 0x7fff);
+                }
+                symbolI = bits[0] ? level : -level;
+                symbolQ = bits[1] ? level : -level;
+            }
+            iq[2 * i] = symbolI;
+            iq[2 * i + 1] = symbolQ;
+            if (++symbolPos == samplesPerSymbol)
+                symbolPos = 0;
+        }
+        break;
+    }
+    case Kind::Noise:
+        std::fill(iq, iq + 2 * n, 0.0f);
+        break;
+    }
+
+    if (noise > 0.0f)
+        addNoise(iq, n, noise);
+}
+
+void SignalGenerator::generate(void *buff, size_t numElems) {
+    float *iq = scratch.data();
+    char *out = static_cast<char *>(buff);
+    const size_t itemSize = Convert::itemSize(format);
+
+    for (size_t done = 0; done < numElems; ) {
+        const size_t n = std::min(BLOCK, numElems - done);
+        synthesize(iq, n);
+        Convert::fromFloat(format, reinterpret_cast<const std::complex<float> *>(iq), out, n);
+        out += n * itemSize;
+        done += n;
+    }
+}
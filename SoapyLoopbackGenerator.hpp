@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <SoapySDR/Types.hpp>
+
+/**
+ * Rx only sample source selected with pipe=gen:tone|noise|chirp|qpsk.
+ * Samples are synthesized in blocks of BLOCK complex floats from a sine lookup
+ * table driven NCO, a xorshift noise source or a PRBS15 QPSK mapper, then
+ * converted to the stream format.
+ *
+ * Stream args:
+ *   gen_freq       tone frequency / chirp half span in Hz
+ *   gen_amplitude  peak amplitude relative to full scale
+ *   gen_noise      additive noise RMS relative to full scale
+ *   gen_period     chirp sweep length in samples
+ *   gen_sps        QPSK samples per symbol
+ */
+class SignalGenerator {
+  public:
+    enum class Kind {
+        Tone,
+        Noise,
+        Chirp,
+        Qpsk
+    };
+
+    static constexpr const char *PIPE_PREFIX = "gen:";
+    static constexpr size_t BLOCK = 1024;
+    static constexpr unsigned LUT_BITS = 12;
+
+    static bool isGeneratorPipe(const std::string &pipeName);
+
+    SignalGenerator(const std::string &pipeName, const std::string &format, double sampleRate, const SoapySDR::Kwargs &args);
+
+    /** Fill numElems samples of the stream format into buff */
+    void generate(void *buff, size_t numElems);
+
+  private:
+    void synthesize(float *iq, size_t n);
+    void addNoise(float *iq, size_t n, float rms);
+    float uniform();
+
+    Kind kind;
+    std::string format;
+    float amplitude;
+    float noise;
+
+    uint32_t phase {0};
+    int64_t phaseIncrement {0};
+    int64_t chirpStart {0};
+    int64_t chirpStep {0};
+    size_t chirpPeriod {0};
+    size_t chirpPos {0};
+
+    size_t samplesPerSymbol {4};
+    size_t symbolPos {0};
+    uint16_t prbs {0x7fff};
+    float symbolI {0}, symbolQ {0};
+
+    uint64_t rng {0x9e3779b97f4a7c15ull};
+
+    std::vector<float> cosLut;
+    std::vector<float> sinLut;
+    std::vector<float> scratch;
+};
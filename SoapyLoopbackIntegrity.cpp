@@ -0,0 +1,123 @@
+#include "SoapyLoopbackIntegrity.hpp"
+
+#include <array>
+#include <cstring>
+
+#include <SoapySDR/Logger.hpp>
+
+#include "SoapyLoopbackConnector.hpp"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace Integrity {
+
+namespace {
+
+constexpr uint32_t POLY = 0x82f63b78; // reflected Castagnoli polynomial
+
+std::array<uint32_t, 256> makeTable() {
+    std::array<uint32_t, 256> table {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (POLY & -(crc & 1));
+        table[i] = crc;
+    }
+    return table;
+}
+
+uint32_t crc32cTable(const unsigned char *data, size_t size, uint32_t crc) {
+    static const std::array<uint32_t, 256> table = makeTable();
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(const unsigned char *data, size_t size, uint32_t crc) {
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; size--, data++)
+        crc = _mm_crc32_u8(crc, *data);
+    return crc;
+}
+
+/* Checked on first use, the cpu model may not be initialised yet while the module is loaded */
+bool haveSse42() {
+    static const bool supported = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") != 0;
+    }();
+    return supported;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+uint32_t crc32cArm(const unsigned char *data, size_t size, uint32_t crc) {
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; size--, data++)
+        crc = __crc32cb(crc, *data);
+    return crc;
+}
+#endif
+
+}
+
+uint32_t crc32c(const void *data, size_t size, uint32_t crc) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+#if defined(__x86_64__)
+    crc = haveSse42() ? crc32cSse42(bytes, size, crc) : crc32cTable(bytes, size, crc);
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    crc = crc32cArm(bytes, size, crc);
+#else
+    crc = crc32cTable(bytes, size, crc);
+#endif
+    return ~crc;
+}
+
+void stamp(Frame &frame, uint64_t sequence) {
+    FrameHeader &header = frame.header();
+    header.flags |= FrameHeader::INTEGRITY;
+    header.sequence = sequence;
+    header.crc = crc32c(frame.payload(), frame.size());
+}
+
+void verify(const Frame &frame, uint64_t &expected, ConnectorStats &stats) {
+    stats.integrityChecked.fetch_add(1, std::memory_order_relaxed);
+
+    const FrameHeader &header = frame.header();
+    if (crc32c(frame.payload(), frame.size()) != header.crc) {
+        stats.integrityCrcErrors.fetch_add(1, std::memory_order_relaxed);
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Integrity: frame %llu CRC mismatch", (unsigned long long) header.sequence);
+    }
+
+    if (header.sequence == 0 && expected != 0) {
+        // Tx restarted its stream, resynchronize
+        SoapySDR_log(SOAPY_SDR_DEBUG, "Integrity: Tx sequence restarted");
+    } else if (header.sequence > expected) {
+        stats.integrityLost.fetch_add(header.sequence - expected, std::memory_order_relaxed);
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Integrity: %llu frame(s) lost before %llu",
+            (unsigned long long) (header.sequence - expected), (unsigned long long) header.sequence);
+    } else if (header.sequence < expected) {
+        stats.integrityDuplicated.fetch_add(1, std::memory_order_relaxed);
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Integrity: frame %llu duplicated or reordered, expected %llu",
+            (unsigned long long) header.sequence, (unsigned long long) expected);
+        return;
+    }
+    expected = header.sequence + 1;
+}
+
+}
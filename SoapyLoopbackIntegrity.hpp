@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct ConnectorStats;
+class Frame;
+
+/*
+ * End to end frame integrity for integrity=true streams: the Tx stamps every
+ * frame with a sequence number and the CRC32C of the payload, the Rx checks
+ * both and counts corrupted, lost and duplicated/reordered frames.
+ */
+namespace Integrity {
+
+    /** CRC32C (Castagnoli), SSE4.2 / ARMv8 CRC instructions when available */
+    uint32_t crc32c(const void *data, size_t size, uint32_t crc = 0);
+
+    void stamp(Frame &frame, uint64_t sequence);
+
+    /**
+     * Verify a received frame, expected is the sequence number of the next frame
+     * and is advanced past the frame.
+     */
+    void verify(const Frame &frame, uint64_t &expected, ConnectorStats &stats);
+}
@@ -0,0 +1,366 @@
+#include "SoapyLoopbackMedium.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <SoapySDR/Constants.h>
+#include <SoapySDR/Logger.hpp>
+
+#include "SoapyLoopbackConvert.hpp"
+
+static std::atomic<uint64_t> nextPortId {1};
+
+//anti-alias filter length per Tx samples per Rx passband, Blackman windowed for about 70 dB stopband
+static constexpr size_t TAPS_PER_RATIO = 16;
+static constexpr size_t MIN_TAPS = 15;
+static constexpr size_t MAX_TAPS = 511;
+
+MediumPort::MediumPort(int direction, const std::string &format, size_t itemSize):
+    id(nextPortId.fetch_add(1, std::memory_order_relaxed)),
+    direction(direction),
+    format(format),
+    itemSize(itemSize) {
+}
+
+void MediumPort::tune(double frequency, double sampleRate, double bandwidth) {
+    this->frequency.store(frequency, std::memory_order_relaxed);
+    this->sampleRate.store(sampleRate, std::memory_order_relaxed);
+    this->bandwidth.store(bandwidth, std::memory_order_relaxed);
+}
+
+/*******************************************************************
+ * Registry
+ ******************************************************************/
+
+namespace {
+    struct MediumRegistry {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::weak_ptr<Medium>> media;
+    };
+
+    MediumRegistry &registry() {
+        // never destroyed, media may be released by streams outliving static destruction
+        static MediumRegistry *instance = new MediumRegistry;
+        return *instance;
+    }
+}
+
+bool Medium::isMediumPipe(const std::string &pipeName) {
+    return pipeName.rfind(PIPE_PREFIX, 0) == 0;
+}
+
+std::shared_ptr<Medium> Medium::getMedium(const std::string &pipeName) {
+    MediumRegistry &reg = registry();
+    std::unique_lock lock(reg.mutex);
+
+    for (auto it = reg.media.begin(); it != reg.media.end(); ) {
+        if (it->second.expired())
+            it = reg.media.erase(it);
+        else
+            ++it;
+    }
+
+    std::weak_ptr<Medium> &entry = reg.media[pipeName];
+    if (auto medium = entry.lock())
+        return medium;
+
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "create medium \"%s\"", pipeName.c_str());
+    auto medium = std::make_shared<Medium>(pipeName);
+    entry = medium;
+    return medium;
+}
+
+Medium::Medium(const std::string &name): name(name) {
+}
+
+/*******************************************************************
+ * Ports
+ ******************************************************************/
+
+void Medium::attach(const std::shared_ptr<MediumPort> &port) {
+    {
+        std::unique_lock lock(port->mutex);
+        port->active = true;
+    }
+    std::unique_lock lock(portsMutex);
+    if (std::find(ports.begin(), ports.end(), port) == ports.end())
+        ports.push_back(port);
+}
+
+void Medium::detach(const std::shared_ptr<MediumPort> &port) {
+    std::unique_lock lock(portsMutex);
+    ports.erase(std::remove(ports.begin(), ports.end(), port), ports.end());
+
+    if (port->direction == SOAPY_SDR_RX) {
+        std::unique_lock portLock(port->mutex);
+        port->active = false;
+        port->backlog.clear();
+        port->cursors.clear();
+        port->cond.notify_all();
+        return;
+    }
+
+    // the receivers stop waiting for a transmitter that left
+    for (auto &rx : ports) {
+        if (rx->direction != SOAPY_SDR_RX)
+            continue;
+        std::unique_lock portLock(rx->mutex);
+        if (rx->cursors.erase(port->id) > 0)
+            rx->cond.notify_all();
+    }
+    port->mixers.clear();
+}
+
+void Medium::setCapacity(MediumPort &rx, size_t samples) {
+    std::unique_lock lock(rx.mutex);
+    rx.capacity = std::max<size_t>(samples, 1);
+}
+
+bool Medium::overlaps(const MediumPort &tx, const MediumPort &rx) {
+    const double distance = std::abs(tx.frequency.load(std::memory_order_relaxed) - rx.frequency.load(std::memory_order_relaxed));
+    return 2 * distance < tx.bandwidth.load(std::memory_order_relaxed) + rx.bandwidth.load(std::memory_order_relaxed);
+}
+
+/*******************************************************************
+ * Tx
+ ******************************************************************/
+
+void Medium::transmit(MediumPort &tx, const void *buff, size_t numElems) {
+    tx.stats.framesPushed.fetch_add(1, std::memory_order_relaxed);
+    tx.stats.bytesPushed.fetch_add(numElems * tx.itemSize, std::memory_order_relaxed);
+    if (numElems == 0)
+        return;
+
+    tx.input.resize(numElems);
+    Convert::toFloat(tx.format, buff, tx.input.data(), numElems);
+    tx.epoch++;
+
+    std::shared_lock lock(portsMutex);
+    for (auto &rx : ports) {
+        if (rx->direction != SOAPY_SDR_RX)
+            continue;
+
+        const bool linked = overlaps(tx, *rx);
+        if (linked) {
+            auto [it, created] = tx.mixers.try_emplace(rx->id);
+            if (it->second.epoch + 1 != tx.epoch)
+                it->second = MediumPort::Mixer{};  // new link or relinked after retuning, restart the mixer
+            it->second.epoch = tx.epoch;
+            mix(tx, it->second, *rx, numElems);
+        }
+        accumulate(tx, *rx, linked);
+    }
+
+    // forget the mixers of receivers that are gone or out of band
+    for (auto it = tx.mixers.begin(); it != tx.mixers.end(); ) {
+        if (it->second.epoch != tx.epoch)
+            it = tx.mixers.erase(it);
+        else
+            ++it;
+    }
+}
+
+/**
+ * Windowed sinc low-pass for the link, cutoff in cycles per Tx sample. The length grows with
+ * the decimation so the transition band stays a fixed fraction of the Rx passband.
+ */
+void Medium::designFilter(MediumPort::Mixer &mixer, double cutoff) {
+    size_t n = std::clamp<size_t>(static_cast<size_t>(std::ceil(TAPS_PER_RATIO * 0.5 / cutoff)), MIN_TAPS, MAX_TAPS) | 1;
+    mixer.cutoff = cutoff;
+    mixer.taps.resize(n);
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        const double m = static_cast<double>(i) - (n - 1) / 2.0;
+        const double sinc = (m == 0) ? 2 * cutoff : std::sin(2 * M_PI * cutoff * m) / (M_PI * m);
+        const double window = 0.42 - 0.5 * std::cos(2 * M_PI * i / (n - 1)) + 0.08 * std::cos(4 * M_PI * i / (n - 1));
+        mixer.taps[i] = static_cast<float>(sinc * window);
+        sum += mixer.taps[i];
+    }
+    // unity gain in the passband
+    for (float &tap : mixer.taps)
+        tap = static_cast<float>(tap / sum);
+    mixer.tail.assign(n - 1, {});
+}
+
+/**
+ * Shift the converted Tx block by the distance between the two center frequencies,
+ * low-pass it to the Rx passband when that is narrower than the Tx rate, and resample it
+ * to the Rx rate with linear interpolation. The filter is only evaluated at the Tx samples
+ * the interpolation reads. The oscillator, the filter history and the resampler phase carry
+ * over between blocks so the output is continuous.
+ */
+void Medium::mix(MediumPort &tx, MediumPort::Mixer &mixer, const MediumPort &rx, size_t numElems) {
+    const double txRate = tx.sampleRate.load(std::memory_order_relaxed);
+    const double rxRate = rx.sampleRate.load(std::memory_order_relaxed);
+    const double rxBandwidth = rx.bandwidth.load(std::memory_order_relaxed);
+    const double offset = tx.frequency.load(std::memory_order_relaxed) - rx.frequency.load(std::memory_order_relaxed);
+
+    const std::complex<float> *in = tx.input.data();
+    if (offset != 0 && txRate > 0) {
+        // shift into a scratch copy, the input is shared by all receivers
+        tx.shifted.resize(numElems);
+        const std::complex<double> step = std::polar(1.0, 2 * M_PI * offset / txRate);
+        std::complex<double> osc = mixer.osc;
+        for (size_t i = 0; i < numElems; i++) {
+            tx.shifted[i] = in[i] * std::complex<float>(osc);
+            osc *= step;
+        }
+        mixer.osc = osc / std::abs(osc);
+        in = tx.shifted.data();
+    }
+
+    // everything outside the Rx passband would fold into it, filter it out first
+    const double passband = std::min(rxRate, rxBandwidth > 0 ? rxBandwidth : rxRate);
+    const double cutoff = (txRate > 0 && passband > 0 && passband < txRate) ? passband / 2 / txRate : 0;
+    if (cutoff != mixer.cutoff) {
+        if (cutoff > 0)
+            designFilter(mixer, cutoff);
+        else {
+            mixer.cutoff = 0;
+            mixer.taps.clear();
+            mixer.tail.clear();
+        }
+    }
+
+    std::vector<std::complex<float>> &out = tx.output;
+    const double ratio = (rxRate > 0) ? txRate / rxRate : 1.0;
+    if (ratio == 1.0 && mixer.taps.empty()) {
+        out.assign(in, in + numElems);
+        mixer.prev = in[numElems - 1];
+        return;
+    }
+
+    // filtered(k) is the Tx sample k of this block after the low-pass
+    const size_t history = mixer.tail.size();
+    const std::complex<float> *src = in;
+    if (history > 0) {
+        tx.extended.resize(history + numElems);
+        std::copy(mixer.tail.begin(), mixer.tail.end(), tx.extended.begin());
+        std::copy(in, in + numElems, tx.extended.begin() + history);
+        src = tx.extended.data();
+    }
+    const float *taps = mixer.taps.data();
+    const size_t ntaps = mixer.taps.size();
+    auto filtered = [&](size_t k) {
+        if (ntaps == 0)
+            return src[k];
+        std::complex<float> acc {};
+        const std::complex<float> *x = src + k;
+        for (size_t t = 0; t < ntaps; t++)
+            acc += x[t] * taps[ntaps - 1 - t];
+        return acc;
+    };
+
+    // position 0 is the last sample of the previous block, position j + 1 is sample j
+    out.clear();
+    out.reserve(static_cast<size_t>(numElems / ratio) + 2);
+    double phase = mixer.phase;
+    size_t cachedIndex = SIZE_MAX;
+    std::complex<float> cached {};
+    while (phase < numElems) {
+        const size_t i = static_cast<size_t>(phase);
+        const float frac = static_cast<float>(phase - i);
+        // the previous output usually read sample i - 1 already
+        const std::complex<float> a = (i == 0) ? mixer.prev : (cachedIndex == i - 1 ? cached : filtered(i - 1));
+        const std::complex<float> b = (frac == 0) ? a : filtered(i);
+        if (frac != 0) {
+            cachedIndex = i;
+            cached = b;
+        }
+        out.push_back(frac == 0 ? a : a + (b - a) * frac);
+        phase += ratio;
+    }
+    mixer.phase = phase - numElems;
+    mixer.prev = filtered(numElems - 1);
+    if (history > 0)
+        std::copy(src + numElems, src + numElems + history, mixer.tail.begin());
+}
+
+/**
+ * Add the mixed Tx block into the Rx backlog at the link cursor. Samples the Rx already
+ * released are dropped, a backlog above capacity drops its oldest samples.
+ */
+void Medium::accumulate(MediumPort &tx, MediumPort &rx, bool linked) {
+    std::unique_lock lock(rx.mutex);
+    if (!linked) {
+        if (rx.cursors.erase(tx.id) > 0)
+            rx.cond.notify_one();
+        return;
+    }
+    if (!rx.active)
+        return;
+
+    // a Tx joining starts at the first sample the Rx has not released yet
+    auto [it, created] = rx.cursors.try_emplace(tx.id, rx.readPos);
+    uint64_t &cursor = it->second;
+    const std::vector<std::complex<float>> &out = tx.output;
+
+    const uint64_t end = cursor + out.size();
+    if (end > rx.readPos + rx.capacity) {
+        const uint64_t newRead = end - rx.capacity;
+        const size_t dropped = std::min<uint64_t>(newRead - rx.readPos, rx.backlog.size());
+        rx.backlog.erase(rx.backlog.begin(), rx.backlog.begin() + dropped);
+        rx.readPos = newRead;
+        rx.stats.overflows.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const size_t skip = (cursor < rx.readPos) ? std::min<uint64_t>(rx.readPos - cursor, out.size()) : 0;
+    cursor += skip;
+    if (end > rx.readPos + rx.backlog.size())
+        rx.backlog.resize(end - rx.readPos);
+
+    auto dst = rx.backlog.begin() + (cursor - rx.readPos);
+    for (size_t i = skip; i < out.size(); i++, ++dst)
+        *dst += out[i];
+    cursor = end;
+
+    rx.cond.notify_one();
+}
+
+/*******************************************************************
+ * Rx
+ ******************************************************************/
+
+/** Samples every linked Tx has written, called with the Rx lock held */
+size_t Medium::available(const MediumPort &rx) const {
+    if (rx.cursors.empty())
+        return 0;
+    uint64_t low = UINT64_MAX;
+    for (const auto &[id, cursor] : rx.cursors)
+        low = std::min(low, cursor);
+    return (low > rx.readPos) ? low - rx.readPos : 0;
+}
+
+size_t Medium::receive(MediumPort &rx, void *buff, size_t numElems, std::chrono::microseconds timeout) {
+    std::unique_lock lock(rx.mutex);
+    const bool ready = rx.cond.wait_for(lock, timeout, [&]() { return !rx.active || available(rx) >= numElems; });
+    if (!rx.active)
+        return 0;
+
+    size_t count = std::min(available(rx), numElems);
+    if (!ready) {
+        // a linked Tx went quiet, release what the others wrote and unlink it until it transmits again
+        count = std::min(rx.backlog.size(), numElems);
+        for (auto it = rx.cursors.begin(); it != rx.cursors.end(); ) {
+            if (it->second < rx.readPos + count)
+                it = rx.cursors.erase(it);
+            else
+                ++it;
+        }
+    }
+    if (count == 0) {
+        rx.stats.underflows.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    rx.scratch.resize(count);
+    std::copy_n(rx.backlog.begin(), count, rx.scratch.begin());
+    rx.backlog.erase(rx.backlog.begin(), rx.backlog.begin() + count);
+    rx.readPos += count;
+    lock.unlock();
+
+    Convert::fromFloat(rx.format, rx.scratch.data(), buff, count);
+    rx.stats.framesPushed.fetch_add(1, std::memory_order_relaxed);
+    rx.stats.bytesPushed.fetch_add(count * rx.itemSize, std::memory_order_relaxed);
+    return count;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SoapyLoopbackConnector.hpp"
+
+/**
+ * One device stream attached to a medium. The tuning is written by the device settings
+ * and read by the transmitting threads, so it is kept in atomics.
+ */
+class MediumPort {
+  public:
+    MediumPort(int direction, const std::string &format, size_t itemSize);
+
+    void tune(double frequency, double sampleRate, double bandwidth);
+
+    const uint64_t id;
+    const int direction;
+    const std::string format;
+    const size_t itemSize;
+
+    std::atomic<double> frequency {0};
+    std::atomic<double> sampleRate {0};
+    std::atomic<double> bandwidth {0};
+
+    ConnectorStats stats;
+
+  private:
+    friend class Medium;
+
+    /** Tx side state of one Tx -> Rx link, only touched by the transmitting thread */
+    struct Mixer {
+        std::complex<double> osc {1.0, 0.0};
+        double phase {1.0};     ///< next Rx sample position in Tx samples, 0 is the previous Tx sample
+        std::complex<float> prev {};  ///< last Tx sample of the previous block, filtered
+        uint64_t epoch {0};
+        double cutoff {0};      ///< low-pass cutoff in cycles per Tx sample the taps were designed for, 0 without filter
+        std::vector<float> taps;
+        std::vector<std::complex<float>> tail;  ///< last taps - 1 shifted Tx samples of the previous block
+    };
+
+    // Tx only
+    std::vector<std::complex<float>> input;
+    std::vector<std::complex<float>> shifted;
+    std::vector<std::complex<float>> extended;  ///< filter tail followed by the shifted block
+    std::vector<std::complex<float>> output;
+    std::unordered_map<uint64_t, Mixer> mixers;
+    uint64_t epoch {0};
+
+    // Rx only, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::complex<float>> backlog;    ///< summed spectrum, front is sample readPos
+    uint64_t readPos {0};
+    std::unordered_map<uint64_t, uint64_t> cursors;  ///< per linked Tx: next Rx sample it writes
+    std::vector<std::complex<float>> scratch;
+    size_t capacity {1 << 20};
+    bool active {true};
+};
+
+/**
+ * Shared virtual spectrum selected with pipe=medium:<name>. Any number of Tx and Rx streams
+ * attach to the same medium, each Rx receives the sum of every Tx whose band overlaps its
+ * own tuning, shifted by the difference of the center frequencies, low-pass filtered to the
+ * Rx bandwidth and resampled to the Rx sample rate.
+ *
+ * The mixing runs on the transmitting threads: every Tx converts its block once, then rotates
+ * and resamples it for each overlapping Rx outside of any lock and only takes the Rx lock to
+ * add the result into the Rx backlog. The work therefore spreads across as many cores as
+ * there are Tx streams. An Rx releases samples once every linked Tx has written past them,
+ * or on timeout when some Tx went quiet.
+ *
+ * There is no back-pressure towards the Tx: a Tx writing faster than an Rx reads pushes the
+ * oldest samples out of the Rx backlog (setCapacity), which counts them as overflows.
+ */
+class Medium {
+  public:
+    static constexpr const char *PIPE_PREFIX = "medium:";
+
+    static bool isMediumPipe(const std::string &pipeName);
+
+    /** Find or create the named medium, freed when the last stream detaches */
+    static std::shared_ptr<Medium> getMedium(const std::string &pipeName);
+
+    explicit Medium(const std::string &name);
+
+    void attach(const std::shared_ptr<MediumPort> &port);
+    void detach(const std::shared_ptr<MediumPort> &port);
+
+    /** Tx: add numElems samples in the port format to every overlapping Rx */
+    void transmit(MediumPort &tx, const void *buff, size_t numElems);
+
+    /**
+     * Rx: wait for up to numElems samples and convert them into buff in the port format.
+     * @return number of samples written, 0 on timeout or when the port was detached
+     */
+    size_t receive(MediumPort &rx, void *buff, size_t numElems, std::chrono::microseconds timeout);
+
+    /** Limit the Rx backlog, the oldest samples are dropped and counted as overflows */
+    void setCapacity(MediumPort &rx, size_t samples);
+
+    const std::string &getName() const { return name; }
+
+  private:
+    static bool overlaps(const MediumPort &tx, const MediumPort &rx);
+    void mix(MediumPort &tx, MediumPort::Mixer &mixer, const MediumPort &rx, size_t numElems);
+    static void designFilter(MediumPort::Mixer &mixer, double cutoff);
+    void accumulate(MediumPort &tx, MediumPort &rx, bool linked);
+    size_t available(const MediumPort &rx) const;
+
+    std::string name;
+    mutable std::shared_mutex portsMutex;
+    std::vector<std::shared_ptr<MediumPort>> ports;
+};
@@ -0,0 +1,119 @@
+#include "SoapyLoopbackNullSink.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Logger.hpp>
+
+NullSink::NullSink(const std::string &format, size_t itemSize, size_t bufferSize, const SoapySDR::Kwargs &args):
+    frame(std::make_unique<Frame>(bufferSize)),
+    format(format),
+    itemSize(itemSize)
+{
+    const std::string mode = (args.count("null_check") > 0) ? args.at("null_check") : "none";
+    if (mode == "none")
+        check = Check::None;
+    else if (mode == "checksum")
+        check = Check::Checksum;
+    else if (mode == "prbs")
+        check = Check::Prbs;
+    else
+        throw std::runtime_error("invalid null_check '" + mode + "' -- use none, checksum or prbs");
+
+    if (args.count("gen_sps") > 0)
+        samplesPerSymbol = std::max(1, std::stoi(args.at("gen_sps")));
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "NullSink %s, check %s", format.c_str(), mode.c_str());
+}
+
+void NullSink::consume(const void *buff, size_t numElems) {
+    const size_t bytes = numElems * itemSize;
+    stats.framesPushed.fetch_add(1, std::memory_order_relaxed);
+    stats.bytesPushed.fetch_add(bytes, std::memory_order_relaxed);
+
+    switch (check) {
+    case Check::None:
+        break;
+    case Check::Checksum:
+        foldChecksum(buff, bytes);
+        break;
+    case Check::Prbs:
+        checkPrbs(buff, numElems);
+        break;
+    }
+}
+
+void NullSink::foldChecksum(const void *buff, size_t bytes) {
+    // independent sum and xor reductions over 32 bit words, both vectorize
+    const unsigned char *data = static_cast<const unsigned char *>(buff);
+    const size_t words = bytes / 4;
+    uint64_t s = 0;
+    uint32_t x = 0;
+    for (size_t i = 0; i < words; i++) {
+        uint32_t word;
+        memcpy(&word, data + 4 * i, 4);
+        s += word;
+        x ^= word;
+    }
+    for (size_t i = 4 * words; i < bytes; i++) {
+        s += data[i];
+        x ^= data[i];
+    }
+    sum.fetch_add(s, std::memory_order_relaxed);
+    parity.fetch_xor(x, std::memory_order_relaxed);
+}
+
+void NullSink::resetChecks() {
+    sum.store(0, std::memory_order_relaxed);
+    parity.store(0, std::memory_order_relaxed);
+    errors.store(0, std::memory_order_relaxed);
+    bits.store(0, std::memory_order_relaxed);
+}
+
+bool NullSink::signOf(const unsigned char *sample, bool quadrature) const {
+    if (format == SOAPY_SDR_CF32) {
+        float v;
+        memcpy(&v, sample + (quadrature ? 4 : 0), 4);
+        return v > 0.0f;
+    }
+    if (format == SOAPY_SDR_CS16) {
+        int16_t v;
+        memcpy(&v, sample + (quadrature ? 2 : 0), 2);
+        return v > 0;
+    }
+    if (format == SOAPY_SDR_CS8) {
+        return static_cast<signed char>(sample[quadrature ? 1 : 0]) > 0;
+    }
+    // CS12: sign bits are I[11] in byte 1 bit 3 and Q[11] in byte 2 bit 7, zero counts as negative
+    if (quadrature)
+        return !(sample[2] & 0x80) && (sample[1] >> 4 || sample[2]);
+    return !(sample[1] & 0x08) && (sample[0] || (sample[1] & 0x0f));
+}
+
+void NullSink::checkPrbs(const void *buff, size_t numElems) {
+    const unsigned char *data = static_cast<const unsigned char *>(buff);
+    uint64_t frameErrors = 0;
+    uint64_t frameBits = 0;
+    for (size_t i = 0; i < numElems; i++) {
+        if (symbolPos++ == 0) {
+            const unsigned char *sample = data + i * itemSize;
+            for (int received: {signOf(sample, false), signOf(sample, true)}) {
+                if (locked < 15) {
+                    // self synchronize: load the first 15 received bits as the generator state
+                    prbs = static_cast<uint16_t>(((prbs << 1) | received) & 0x7fff);
+                    locked++;
+                    continue;
+                }
+                const int expected = ((prbs >> 14) ^ (prbs >> 13)) & 1;
+                prbs = static_cast<uint16_t>(((prbs << 1) | expected) & 0x7fff);
+                frameErrors += (expected != received);
+                frameBits++;
+            }
+        }
+        if (symbolPos == samplesPerSymbol)
+            symbolPos = 0;
+    }
+    errors.fetch_add(frameErrors, std::memory_order_relaxed);
+    bits.fetch_add(frameBits, std::memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <SoapySDR/Types.hpp>
+
+#include "SoapyLoopbackConnector.hpp"
+
+/**
+ * Tx only sink selected with pipe=null, frames are consumed in releaseWriteBuffer and
+ * immediately handed back to the Tx. Used to measure the raw output rate of a modulator.
+ *
+ * null_check=none|checksum|prbs selects the optional per frame work:
+ *   checksum  fold the payload into a running 64 bit checksum
+ *   prbs      check the I/Q signs against the PRBS15 QPSK pattern of gen:qpsk,
+ *             sampled once per gen_sps samples
+ */
+class NullSink {
+  public:
+    enum class Check {
+        None,
+        Checksum,
+        Prbs
+    };
+
+    static constexpr const char *PIPE_NAME = "null";
+
+    NullSink(const std::string &format, size_t itemSize, size_t bufferSize, const SoapySDR::Kwargs &args);
+
+    void consume(const void *buff, size_t numElems);
+
+    ConnectorStats stats;
+    std::unique_ptr<Frame> frame;
+
+    uint64_t checksum() const {
+        return sum.load(std::memory_order_relaxed) ^ (static_cast<uint64_t>(parity.load(std::memory_order_relaxed)) << 32);
+    }
+    uint64_t prbsErrors() const { return errors.load(std::memory_order_relaxed); }
+    uint64_t prbsBits() const { return bits.load(std::memory_order_relaxed); }
+
+    /** Clear the checksum and the PRBS counters, the PRBS stays synchronized */
+    void resetChecks();
+
+  private:
+    void foldChecksum(const void *buff, size_t bytes);
+    void checkPrbs(const void *buff, size_t numElems);
+    bool signOf(const unsigned char *sample, bool quadrature) const;
+
+    Check check;
+    std::string format;
+    size_t itemSize;
+
+    // written by the Tx thread, read by the sensors
+    std::atomic<uint64_t> sum {0};
+    std::atomic<uint32_t> parity {0};
+
+    size_t samplesPerSymbol {4};
+    size_t symbolPos {0};
+    uint16_t prbs {0};
+    unsigned locked {0};  ///< bits loaded into the PRBS state, checking starts at 15
+    std::atomic<uint64_t> errors {0};
+    std::atomic<uint64_t> bits {0};
+};
@@ -25,18 +25,33 @@
 
 #include "SoapyLoopback.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstring>
 
 #include <SoapySDR/Logger.hpp>
 #include <SoapySDR/Formats.hpp>
 #include <SoapySDR/Time.hpp>
 
+#include "SoapyLoopbackGenerator.hpp"
+#include "SoapyLoopbackIntegrity.hpp"
+#include "SoapyLoopbackMedium.hpp"
 #include "SoapyLoopbackRx.hpp"
+#include "SoapyLoopbackTrace.hpp"
 #include "config.h"
 
 using namespace std::chrono_literals;
 
+//bytes of the next frame's payload loaded when a frame is released
+static constexpr size_t NEXT_FRAME_PREFETCH = 1024;
+
+//digital_agc levels the stream to this power, moving a fraction of the error per level window
+static constexpr float AGC_TARGET_DBFS = -12;
+static constexpr float AGC_SPEED = 0.5f;
+static constexpr float AGC_MIN_DB = -40;
+static constexpr float AGC_MAX_DB = 60;
+
 SoapyLoopbackRx::SoapyLoopbackRx(const SoapySDR::Kwargs &args): SoapyLoopback(args)
 {
 
@@ -64,39 +79,54 @@ int SoapyLoopbackRx::readStream(
     void *buff0 = buffs[0];
 
     //drop remainder buffer on reset
-    if (buffer.reset && buffer.aquired.bufferedElems != 0)
+    if (stream->reset && stream->aquired.bufferedElems != 0)
     {
-        buffer.aquired.bufferedElems = 0;
-        if (buffer.aquired.frame)
+        stream->aquired.bufferedElems = 0;
+        if (stream->aquired.frame)
             this->releaseReadBuffer(stream, 0);
     }
 
     //are elements left in the buffer?
-    if (buffer.aquired.bufferedElems == 0)
+    if (stream->aquired.bufferedElems == 0)
     {   //if not, do a new read.
-        size_t handle = 0;
-        int ret = this->acquireReadBuffer(stream, handle, (const void **)&buffer.aquired.currentBuff, flags, timeNs, timeoutUs);
+        int ret = pullFrame(stream, flags, timeNs, timeoutUs);
         if (ret <= 0) 
             return ret;
-        buffer.aquired.bufferedElems = ret;
+        stream->aquired.bufferedElems = ret;
     }
-    else
-    {   //otherwise just update return time to the current tick count
-        //flags |= SOAPY_SDR_HAS_TIME;
-        //timeNs = SoapySDR::ticksToTimeNs(bufTicks, sampleRate);
+    else if (simTime)
+    {   //otherwise just update return time to the tick of the first remaining sample
+        flags |= SOAPY_SDR_HAS_TIME;
+        timeNs = SoapySDR::ticksToTimeNs(stream->ticks - stream->aquired.bufferedElems, tuningOf(SOAPY_SDR_RX).sampleRate);
     }
 
-    size_t returnedElems = std::min(buffer.aquired.bufferedElems, numElems);
-
-
-    memcpy(buff0, buffer.aquired.currentBuff, returnedElems*stream->itemSize);
+    size_t returnedElems = std::min(stream->aquired.bufferedElems, numElems);
+
+    //converts from the Tx format, measures, corrects, swaps and scales while copying
+    Convert::CopyOptions options = stream->copy;
+    Convert::Levels levels;
+    if (!digitalAGC)
+        stream->agcGainDb = 0;
+    if (!dcOffsetMode)
+        stream->dcOffset = {};
+    const bool measuring = digitalAGC || dcOffsetMode || stream->levels.armed;
+    if (measuring)
+        options.levels = &levels;
+    options.dcOffset = stream->dcOffset;
+    const float agcGainDb = stream->agcGainDb.load(std::memory_order_relaxed);
+    if (agcGainDb != 0)
+        options.scale *= std::pow(10.0f, agcGainDb / 20);
+    Convert::copy(stream->aquired.format, stream->aquired.currentBuff, stream->formatId, buff0, returnedElems, options);
+    if (measuring && stream->levels.add(levels))
+        applyLevels(stream);
     //bump variables for next call into readStream
-    buffer.aquired.bufferedElems -= returnedElems;
-    buffer.aquired.currentBuff += returnedElems*stream->itemSize;
-    //bufTicks += returnedElems; //for the next call to readStream if there is a remainder
+    stream->aquired.bufferedElems -= returnedElems;
+    stream->aquired.currentBuff += returnedElems*Convert::itemSize(stream->aquired.format);
+    if (simTime)
+        advanceTicks(SOAPY_SDR_RX, stream->ticks - stream->aquired.bufferedElems);
 
     //return number of elements written to buff0
-    if (buffer.aquired.bufferedElems > 0)
+    if (stream->aquired.bufferedElems > 0)
         flags |= SOAPY_SDR_MORE_FRAGMENTS;
     else 
         this->releaseReadBuffer(stream, 0);
@@ -108,6 +138,32 @@ int SoapyLoopbackRx::readStream(
  * Direct buffer access API
  ******************************************************************/
 
+/** A level window completed, track the DC and the AGC gain */
+void SoapyLoopbackRx::applyLevels(SoapySDR::Stream *stream)
+{
+    const LevelMeter::Measurement measurement = stream->levels.last();
+    if (dcOffsetMode)
+        stream->dcOffset = measurement.dc;
+    if (digitalAGC)
+    {
+        //measured before the gain, so the loop does not see its own output
+        const float wanted = std::clamp<float>(AGC_TARGET_DBFS - measurement.powerDbfs, AGC_MIN_DB, AGC_MAX_DB);
+        const float gain = stream->agcGainDb.load(std::memory_order_relaxed);
+        stream->agcGainDb.store(gain + AGC_SPEED * (wanted - gain), std::memory_order_relaxed);
+    }
+}
+
+/** The buffer starts at tick, the stream position moves past it */
+void SoapyLoopbackRx::stampTime(SoapySDR::Stream *stream, const long long tick, const size_t numElems, int &flags, long long &timeNs)
+{
+    stream->ticks = tick + numElems;
+    if (simTime)
+    {
+        flags |= SOAPY_SDR_HAS_TIME;
+        timeNs = SoapySDR::ticksToTimeNs(tick, tuningOf(SOAPY_SDR_RX).sampleRate);
+    }
+}
+
 
 int SoapyLoopbackRx::acquireReadBuffer(
     SoapySDR::Stream *stream,
@@ -117,31 +173,98 @@ int SoapyLoopbackRx::acquireReadBuffer(
     long long &timeNs,
     const long timeoutUs)
 {
+    LOOPBACK_TRACE_SCOPE("SoapyLoopbackRx::acquireReadBuffer");
+    const int numElems = pullFrame(stream, flags, timeNs, timeoutUs);
+    if (numElems <= 0)
+        return numElems;
+    buffs[0] = stream->aquired.currentBuff;
+
+    //the user gets the stream format, a frame from a Tx of another format is converted aside
+    if (stream->aquired.format != stream->formatId)
+    {
+        stream->converted.resize(numElems * stream->itemSize);
+        Convert::copy(stream->aquired.format, stream->aquired.currentBuff, stream->formatId, stream->converted.data(), numElems, {});
+        buffs[0] = stream->converted.data();
+    }
+    handle = 0;
+    return numElems;
+}
+
+int SoapyLoopbackRx::pullFrame(SoapySDR::Stream *stream, int &flags, long long &timeNs, const long timeoutUs)
+{
+    if (stream->generator) {
+        stream->aquired.frame = std::move(stream->localFrame);
+        const size_t numElems = stream->aquired.frame->size() / stream->itemSize;
+        stream->generator->generate(stream->aquired.frame->payload(), numElems);
+        stream->aquired.format = stream->formatId;
+        stream->aquired.currentBuff = stream->aquired.frame->payload();
+        stampTime(stream, stream->ticks, numElems, flags, timeNs);
+        return numElems;
+    }
+
+    if (stream->medium) {
+        char *data = stream->localFrame->payload();
+        const size_t numElems = stream->medium->receive(*stream->mediumPort, data,
+            stream->localFrame->size() / stream->itemSize, std::chrono::microseconds(timeoutUs));
+        if (numElems == 0)
+            return 0;
+        stream->aquired.frame = std::move(stream->localFrame);
+        stream->aquired.format = stream->formatId;
+        stream->aquired.currentBuff = data;
+        stampTime(stream, stream->ticks, numElems, flags, timeNs);
+        return numElems;
+    }
+
+    //never activated, there is nothing to read from
+    if (!stream->pipe)
+        return SOAPY_SDR_TIMEOUT;
+
     //SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopbackRx::acquireReadBuffer");
     do {
-      buffer.aquired.frame = std::move(stream->pipe->pullData(static_cast<std::chrono::microseconds>(timeoutUs)));
+      stream->aquired.frame = std::move(stream->pipe->pullData(pipeTimeout(timeoutUs), stream->wait));
     }
-    while (stream->pipe->isActive() && !buffer.aquired.frame);
+    while (stream->pipe->isActive() && !stream->aquired.frame);
 
-    if (!buffer.aquired.frame) {
-        buffer.aquired.currentBuff = nullptr;
-        buffer.aquired.bufferedElems = 0;
+    if (!stream->aquired.frame) {
+        stream->aquired.currentBuff = nullptr;
+        stream->aquired.bufferedElems = 0;
         return 0;
     }
 
-    buffer.aquired.currentBuff = (char *) buffer.aquired.frame->data.data();
-    buffs[0] = buffer.aquired.frame->data.data();
+    const FrameHeader &header = stream->aquired.frame->header();
+    if (header.flags & FrameHeader::INTEGRITY)
+        Integrity::verify(*stream->aquired.frame, stream->sequence, stream->pipe->getStats());
+
+    //frames are in the Tx format, readStream converts them
+    stream->aquired.format = static_cast<Convert::Format>(header.format);
+    if (Convert::itemSize(stream->aquired.format) == 0)
+        stream->aquired.format = stream->formatId;
+    const size_t numElems = stream->aquired.frame->size() / Convert::itemSize(stream->aquired.format);
+    stream->aquired.currentBuff = stream->aquired.frame->payload();
+    if (header.flags & FrameHeader::END_BURST)
+        flags |= SOAPY_SDR_END_BURST;
+    stampTime(stream, header.tick, numElems, flags, timeNs);
     //SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopbackRx::acquireReadBuffer DONE");
-    return buffer.aquired.frame->data.size() / stream->itemSize;
+    return numElems;
 }
 
 void SoapyLoopbackRx::releaseReadBuffer(
     SoapySDR::Stream *stream,
     const size_t handle) 
 {
-    stream->pipe->pushEmpty(std::move(buffer.aquired.frame));
-    buffer.aquired.currentBuff = nullptr;
-    buffer.aquired.bufferedElems = 0;
+    LOOPBACK_TRACE_SCOPE("SoapyLoopbackRx::releaseReadBuffer");
+    if (simTime)
+        advanceTicks(SOAPY_SDR_RX, stream->ticks);
+    if (stream->generator || stream->medium)
+        stream->localFrame = std::move(stream->aquired.frame);
+    else if (stream->pipe)
+    {
+        stream->pipe->pushEmpty(std::move(stream->aquired.frame));
+        //start loading the next frame while the user works on this one
+        stream->pipe->prefetchData(NEXT_FRAME_PREFETCH);
+    }
+    stream->aquired.currentBuff = nullptr;
+    stream->aquired.bufferedElems = 0;
 }
 
 int SoapyLoopbackRx::activateStream(
@@ -157,6 +280,26 @@ int SoapyLoopbackRx::activateStream(
 
     //start the async thread
 
+    applyThreadConfig(stream->threads, "SoapyLoopbackRx::activateStream");
+    stream->ticks = currentTicks(SOAPY_SDR_RX);
+    if (SignalGenerator::isGeneratorPipe(stream->pipeName)) {
+        stream->generator = std::make_unique<SignalGenerator>(stream->pipeName, stream->format, tuningOf(SOAPY_SDR_RX).sampleRate, stream->args);
+        stream->localFrame = std::make_unique<Frame>(stream->bufferSize - stream->bufferSize % stream->itemSize);
+        return numElems;
+    }
+    if (Medium::isMediumPipe(stream->pipeName)) {
+        if (!stream->localFrame)
+            stream->localFrame = std::make_unique<Frame>(stream->bufferSize - stream->bufferSize % stream->itemSize);
+        if (!stream->mediumPort)
+            stream->mediumPort = std::make_shared<MediumPort>(SOAPY_SDR_RX, stream->format, stream->itemSize);
+        stream->mediumPort->tune(tuningOf(SOAPY_SDR_RX).centerFrequency, tuningOf(SOAPY_SDR_RX).sampleRate, getBandwidth(SOAPY_SDR_RX, 0));
+        stream->medium = Medium::getMedium(stream->pipeName);
+        stream->medium->setCapacity(*stream->mediumPort, stream->noOfBuffers * (stream->bufferSize / stream->itemSize));
+        stream->medium->attach(stream->mediumPort);
+        return numElems;
+    }
+
+    stream->sequence = 0;
     stream->pipe = Connector::getConnector(stream->pipeName);
     stream->pipe->activate();
     return numElems;
@@ -169,6 +312,15 @@ int SoapyLoopbackRx::deactivateStream(SoapySDR::Stream *stream, const int flags,
     if (flags != 0) 
         return SOAPY_SDR_NOT_SUPPORTED;
 
+    if (stream->generator) {
+        //the generator and its frame stay until closeStream, a read after deactivation still has a source
+        return 0;
+    }
+    if (stream->medium) {
+        stream->medium->detach(stream->mediumPort);
+        return 0;
+    }
+
     stream->pipe->notiffyExit();
     return 0;
 }
@@ -37,7 +37,7 @@
 #include "SoapyLoopback.hpp"
 #include "config.h"
 
-class SoapyLoopbackRx: public SoapyLoopback
+class SoapyLoopbackRx: public virtual SoapyLoopback
 {
 public:
     SoapyLoopbackRx(const SoapySDR::Kwargs &args);
@@ -93,4 +93,11 @@ public:
     
 private:
     void rx_async_operation(void);
+
+    /** Take the next frame as the acquired one, returns its length in items of the Tx format it holds */
+    int pullFrame(SoapySDR::Stream *stream, int &flags, long long &timeNs, const long timeoutUs);
+
+    void stampTime(SoapySDR::Stream *stream, const long long tick, const size_t numElems, int &flags, long long &timeNs);
+
+    void applyLevels(SoapySDR::Stream *stream);
 };
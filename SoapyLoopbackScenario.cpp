@@ -0,0 +1,337 @@
+#include "SoapyLoopbackScenario.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <SoapySDR/Constants.h>
+
+namespace {
+
+    /** Just enough JSON for scenario files: objects, arrays, numbers, strings, booleans and null */
+    class JsonReader {
+      public:
+        JsonReader(const std::string &text, const std::string &source): text(text), source(source) {}
+
+        [[noreturn]] void fail(const std::string &what) const {
+            size_t line = 1;
+            for (size_t i = 0; i < pos && i < text.size(); i++)
+                line += text[i] == '\n';
+            throw std::runtime_error(source + ":" + std::to_string(line) + ": " + what);
+        }
+
+        void skipSpace() {
+            while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+                pos++;
+        }
+
+        char peek() {
+            skipSpace();
+            return pos < text.size() ? text[pos] : '\0';
+        }
+
+        bool consume(char c) {
+            if (peek() != c)
+                return false;
+            pos++;
+            return true;
+        }
+
+        void expect(char c) {
+            if (!consume(c))
+                fail(std::string("expected '") + c + "'");
+        }
+
+        bool atEnd() {
+            return peek() == '\0';
+        }
+
+        std::string string() {
+            expect('"');
+            std::string out;
+            while (pos < text.size() && text[pos] != '"') {
+                char c = text[pos++];
+                if (c == '\\') {
+                    if (pos >= text.size())
+                        break;
+                    c = text[pos++];
+                    switch (c) {
+                    case 'n': c = '\n'; break;
+                    case 't': c = '\t'; break;
+                    case 'r': c = '\r'; break;
+                    case '"': case '\\': case '/': break;
+                    default: fail(std::string("unsupported escape \\") + c);
+                    }
+                }
+                out += c;
+            }
+            if (pos >= text.size())
+                fail("unterminated string");
+            pos++;
+            return out;
+        }
+
+        double number() {
+            skipSpace();
+            const char *begin = text.c_str() + pos;
+            char *end = nullptr;
+            const double value = std::strtod(begin, &end);
+            if (end == begin)
+                fail("expected a number");
+            pos += end - begin;
+            return value;
+        }
+
+        bool literal(const char *word) {
+            skipSpace();
+            const size_t n = strlen(word);
+            if (text.compare(pos, n, word) != 0)
+                return false;
+            pos += n;
+            return true;
+        }
+
+        /** Skips a value of any type, for keys the scenario does not know */
+        void skipValue() {
+            const char c = peek();
+            if (c == '"')
+                string();
+            else if (c == '{' || c == '[') {
+                const char close = c == '{' ? '}' : ']';
+                pos++;
+                if (consume(close))
+                    return;
+                do {
+                    if (close == '}') {
+                        string();
+                        expect(':');
+                    }
+                    skipValue();
+                } while (consume(','));
+                expect(close);
+            } else if (!literal("true") && !literal("false") && !literal("null"))
+                number();
+        }
+
+        /** Calls member(key) for each key of an object, member reads the value */
+        template <typename F>
+        void object(F member) {
+            expect('{');
+            if (consume('}'))
+                return;
+            do {
+                const std::string key = string();
+                expect(':');
+                member(key);
+            } while (consume(','));
+            expect('}');
+        }
+
+        template <typename F>
+        void array(F element) {
+            expect('[');
+            if (consume(']'))
+                return;
+            do
+                element();
+            while (consume(','));
+            expect(']');
+        }
+
+      private:
+        const std::string &text;
+        const std::string &source;
+        size_t pos {0};
+    };
+}
+
+/*******************************************************************
+ * Scenario
+ ******************************************************************/
+
+std::shared_ptr<const Scenario> Scenario::load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("scenario " + path + " can not be opened");
+    std::stringstream text;
+    text << file.rdbuf();
+    return parse(text.str(), path);
+}
+
+std::shared_ptr<const Scenario> Scenario::parse(const std::string &json, const std::string &path) {
+    auto scenario = std::make_shared<Scenario>();
+    scenario->path = path;
+    JsonReader reader(json, path.empty() ? "scenario" : path);
+
+    reader.object([&](const std::string &key) {
+        if (key == "seed") {
+            scenario->seed = static_cast<uint64_t>(reader.number());
+            return;
+        }
+        if (key != "events") {
+            reader.skipValue();
+            return;
+        }
+        reader.array([&]() {
+            Event event;
+            bool hasTick = false;
+            reader.object([&](const std::string &name) {
+                if (name == "tick") {
+                    const double tick = reader.number();
+                    if (tick < 0 || tick != std::floor(tick))
+                        reader.fail("tick must be a non negative integer");
+                    event.tick = static_cast<long long>(tick);
+                    hasTick = true;
+                } else if (name == "gain_db")
+                    event.gainDb = static_cast<float>(reader.number());
+                else if (name == "freq_offset_hz")
+                    event.freqOffsetHz = reader.number();
+                else if (name == "snr_db") {
+                    if (reader.literal("null"))
+                        event.snrDb.emplace();
+                    else
+                        event.snrDb.emplace(static_cast<float>(reader.number()));
+                } else if (name == "link") {
+                    const std::string state = reader.string();
+                    if (state != "up" && state != "down")
+                        reader.fail("link must be \"up\" or \"down\"");
+                    event.linkUp = state == "up";
+                } else if (name == "delay") {
+                    const double delay = reader.number();
+                    if (delay < 0 || delay != std::floor(delay) || delay > MAX_DELAY)
+                        reader.fail("delay must be an integer between 0 and " + std::to_string(MAX_DELAY));
+                    event.delay = static_cast<size_t>(delay);
+                } else
+                    reader.fail("unknown event key " + name);
+            });
+            if (!hasTick)
+                reader.fail("event without tick");
+            if (event.delay)
+                scenario->maxDelay = std::max(scenario->maxDelay, *event.delay);
+            scenario->events.push_back(event);
+        });
+    });
+    if (!reader.atEnd())
+        reader.fail("trailing characters");
+
+    // events of the same tick are applied in file order
+    std::stable_sort(scenario->events.begin(), scenario->events.end(),
+        [](const Event &a, const Event &b) { return a.tick < b.tick; });
+    return scenario;
+}
+
+/*******************************************************************
+ * Player
+ ******************************************************************/
+
+ScenarioPlayer::ScenarioPlayer(std::shared_ptr<const Scenario> scenario):
+    scenario(std::move(scenario)),
+    rng(this->scenario->getSeed() ? this->scenario->getSeed() : 1) {
+    if (this->scenario->getMaxDelay() > 0)
+        history.assign(this->scenario->getMaxDelay() + 1, {});
+}
+
+void ScenarioPlayer::apply(const Scenario::Event &event) {
+    if (event.gainDb)
+        gain = std::pow(10.0f, *event.gainDb / 20);
+    if (event.freqOffsetHz)
+        freqOffsetHz = *event.freqOffsetHz;
+    if (event.snrDb)
+        snrDb = *event.snrDb;
+    if (event.linkUp)
+        linkUp = *event.linkUp;
+    if (event.delay)
+        delay = *event.delay;
+}
+
+bool ScenarioPlayer::identity() const {
+    return gain == 1.0f && freqOffsetHz == 0 && !snrDb && linkUp && history.empty();
+}
+
+float ScenarioPlayer::gaussian() {
+    // xorshift64* like the signal generator, Irwin-Hall sum of 4 uniforms scaled to unit variance
+    float sum = 0;
+    for (int i = 0; i < 4; i++) {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        sum += static_cast<float>((rng * 0x2545f4914f6cdd1dull) >> 40) * (1.0f / 16777216.0f) - 0.5f;
+    }
+    return sum * std::sqrt(3.0f);
+}
+
+void ScenarioPlayer::segment(std::complex<float> *iq, size_t n, double sampleRate) {
+    if (!history.empty()) {
+        // the line always runs so a delay change picks up the samples already sent
+        const size_t size = history.size();
+        for (size_t i = 0; i < n; i++) {
+            history[historyPos] = iq[i];
+            iq[i] = history[(historyPos + size - delay) % size];
+            historyPos = (historyPos + 1) % size;
+        }
+    }
+
+    if (gain != 1.0f) {
+        for (size_t i = 0; i < n; i++)
+            iq[i] *= gain;
+    }
+
+    if (freqOffsetHz != 0 && sampleRate > 0) {
+        // double precision oscillator, renormalized per segment
+        const std::complex<double> step = std::polar(1.0, 2 * M_PI * freqOffsetHz / sampleRate);
+        for (size_t i = 0; i < n; i++) {
+            iq[i] *= std::complex<float>(osc);
+            osc *= step;
+        }
+        osc /= std::abs(osc);
+    }
+
+    if (!linkUp)
+        std::fill(iq, iq + n, std::complex<float>());
+
+    if (snrDb) {
+        if (linkUp) {
+            float power = 0;
+            for (size_t i = 0; i < n; i++)
+                power += std::norm(iq[i]);
+            if (n > 0 && power > 0)
+                referencePower = power / n;
+        }
+        // the noise floor stays where it was while the link is down
+        const float rms = std::sqrt(referencePower * std::pow(10.0f, -*snrDb / 10) / 2);
+        if (rms > 0) {
+            for (size_t i = 0; i < n; i++)
+                iq[i] += std::complex<float>(rms * gaussian(), rms * gaussian());
+        }
+    }
+}
+
+void ScenarioPlayer::process(Convert::Format format, void *buff, size_t numElems, long long tick, double sampleRate) {
+    const auto &events = scenario->getEvents();
+    const long long end = tick + static_cast<long long>(numElems);
+    // nothing to do for the block when no event falls into it and the channel is clear
+    const bool changes = next < events.size() && events[next].tick < end;
+    if (!changes && identity())
+        return;
+
+    scratch.resize(numElems);
+    Convert::toFloat(format, buff, scratch.data(), numElems);
+
+    size_t done = 0;
+    while (done < numElems) {
+        // events at or before the current sample take effect on it
+        while (next < events.size() && events[next].tick <= tick + static_cast<long long>(done))
+            apply(events[next++]);
+        size_t until = numElems;
+        if (next < events.size())
+            until = static_cast<size_t>(std::min<long long>(events[next].tick - tick, numElems));
+        segment(scratch.data() + done, until - done, sampleRate);
+        done = until;
+    }
+
+    Convert::fromFloat(format, scratch.data(), buff, numElems);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "SoapyLoopbackConvert.hpp"
+
+/**
+ * Channel changes scheduled at Tx sample ticks, loaded with writeSetting("scenario", path)
+ * from a JSON file:
+ *
+ *   {
+ *     "seed": 1,
+ *     "events": [
+ *       {"tick": 0,      "gain_db": -6, "snr_db": 20},
+ *       {"tick": 48000,  "link": "down"},
+ *       {"tick": 96000,  "link": "up", "freq_offset_hz": 150, "delay": 12}
+ *     ]
+ *   }
+ *
+ * Every event sets any subset of gain_db, freq_offset_hz, snr_db (null for no noise),
+ * link ("up" or "down") and delay (samples). The events are sorted by tick on load.
+ */
+class Scenario {
+  public:
+    struct Event {
+        long long tick {0};
+        std::optional<float> gainDb;
+        std::optional<double> freqOffsetHz;
+        std::optional<std::optional<float>> snrDb;  ///< an empty inner value removes the noise
+        std::optional<bool> linkUp;
+        std::optional<size_t> delay;
+    };
+
+    static constexpr size_t MAX_DELAY = 1 << 20;
+
+    static std::shared_ptr<const Scenario> load(const std::string &path);
+    static std::shared_ptr<const Scenario> parse(const std::string &json, const std::string &path = "");
+
+    const std::string &getPath() const { return path; }
+    const std::vector<Event> &getEvents() const { return events; }
+    uint64_t getSeed() const { return seed; }
+    size_t getMaxDelay() const { return maxDelay; }
+
+  private:
+    std::string path;
+    std::vector<Event> events;
+    uint64_t seed {1};
+    size_t maxDelay {0};
+};
+
+/**
+ * Applies a scenario to the samples of one Tx stream. The block is split at the event
+ * ticks so every change takes effect on exactly its sample; each segment is delayed,
+ * scaled, shifted, gated by the link state and gets noise at the scenario SNR relative
+ * to its own power.
+ */
+class ScenarioPlayer {
+  public:
+    explicit ScenarioPlayer(std::shared_ptr<const Scenario> scenario);
+
+    /** Transform numElems samples of the format in place, the first sample is at tick */
+    void process(Convert::Format format, void *buff, size_t numElems, long long tick, double sampleRate);
+
+    const Scenario &getScenario() const { return *scenario; }
+
+  private:
+    void apply(const Scenario::Event &event);
+    bool identity() const;
+    void segment(std::complex<float> *iq, size_t n, double sampleRate);
+    float gaussian();
+
+    std::shared_ptr<const Scenario> scenario;
+    size_t next {0};  ///< first event not applied yet
+
+    float gain {1.0f};
+    double freqOffsetHz {0};
+    std::optional<float> snrDb;
+    bool linkUp {true};
+    size_t delay {0};
+
+    std::complex<double> osc {1.0, 0.0};
+    float referencePower {0};           ///< signal power the noise is scaled to, kept while the link is down
+    std::vector<std::complex<float>> history;  ///< delay line, getMaxDelay() + 1 samples
+    size_t historyPos {0};
+    uint64_t rng;
+
+    std::vector<std::complex<float>> scratch;
+};
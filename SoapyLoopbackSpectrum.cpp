@@ -0,0 +1,174 @@
+#include "SoapyLoopbackSpectrum.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <SoapySDR/Constants.h>
+
+#include "SoapyLoopbackConnector.hpp"
+
+/*******************************************************************
+ * FFT
+ ******************************************************************/
+
+Fft::Fft(size_t size): n(size) {
+    if (n < 2 || (n & (n - 1)) != 0)
+        throw std::runtime_error("Fft size " + std::to_string(n) + " is not a power of two");
+
+    unsigned bits = 0;
+    while ((size_t(1) << bits) < n)
+        bits++;
+    reversed.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t r = 0;
+        for (unsigned b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        reversed[i] = r;
+    }
+
+    twiddles.resize(n / 2);
+    for (size_t k = 0; k < n / 2; k++)
+        twiddles[k] = std::polar(1.0f, static_cast<float>(-2 * M_PI * k / n));
+}
+
+void Fft::forward(std::complex<float> *data) const {
+    for (size_t i = 0; i < n; i++) {
+        if (i < reversed[i])
+            std::swap(data[i], data[reversed[i]]);
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        const size_t half = len / 2;
+        const size_t step = n / len;
+        for (size_t start = 0; start < n; start += len) {
+            for (size_t j = 0; j < half; j++) {
+                const std::complex<float> t = twiddles[j * step] * data[start + j + half];
+                data[start + j + half] = data[start + j] - t;
+                data[start + j] += t;
+            }
+        }
+    }
+}
+
+/*******************************************************************
+ * Monitor
+ ******************************************************************/
+
+SpectrumMonitor::SpectrumMonitor(size_t size, const ThreadConfig &threads):
+    lastReadNs(ConnectorStats::nowNs()),
+    fftSize(size) {
+    Fft check(size);
+    thread = std::thread(&SpectrumMonitor::run, this, threads);
+}
+
+SpectrumMonitor::~SpectrumMonitor() {
+    {
+        std::unique_lock lock(mutex);
+        stopping = true;
+        cond.notify_all();
+    }
+    thread.join();
+}
+
+void SpectrumMonitor::setSize(size_t size) {
+    Fft check(size);
+    std::unique_lock lock(mutex);
+    fftSize = size;
+    filling.reset();
+    average.clear();
+}
+
+void SpectrumMonitor::tap(const Frame &frame) {
+    const long long now = ConnectorStats::nowNs();
+    if (now - lastReadNs.load(std::memory_order_relaxed) > IDLE_AFTER_NS)
+        return;
+    std::unique_lock lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock() || ready)
+        return;
+
+    const auto format = static_cast<Convert::Format>(frame.header().format);
+    const size_t itemSize = Convert::itemSize(format);
+    if (itemSize == 0)
+        return;
+    if (!filling) {
+        if (now < nextTapNs)
+            return;
+        filling = std::make_shared<Tap>();
+        filling->format = format;
+        filling->bytes.resize(fftSize * itemSize);
+    }
+    if (filling->format != format) {
+        // the Tx changed its format, start over
+        filling.reset();
+        return;
+    }
+
+    const size_t take = std::min(frame.size() / itemSize, fftSize - filling->samples);
+    memcpy(filling->bytes.data() + filling->samples * itemSize, frame.payload(), take * itemSize);
+    filling->samples += take;
+    if (filling->samples < fftSize)
+        return;
+
+    ready = std::move(filling);
+    nextTapNs = now + TAP_INTERVAL_NS;
+    cond.notify_one();
+}
+
+void SpectrumMonitor::run(ThreadConfig threads) {
+    if (!threads.empty())
+        applyThreadConfig(threads, "SpectrumMonitor");
+    std::unique_lock lock(mutex);
+    while (true) {
+        cond.wait(lock, [this]() { return stopping || ready; });
+        if (stopping)
+            return;
+        std::shared_ptr<const Tap> tap = ready;
+        lock.unlock();
+        transform(*tap);
+        lock.lock();
+        ready.reset();
+    }
+}
+
+void SpectrumMonitor::transform(const Tap &tap) {
+    const size_t n = tap.samples;
+    // the tables outlive a tap, they are rebuilt when the size changes
+    if (!fft || fft->size() != n) {
+        fft = std::make_unique<Fft>(n);
+        window.resize(n);
+        float sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2 * M_PI * i / n));
+            sum += window[i];
+        }
+        // a full scale tone reads 0 dBFS
+        windowGain = 1.0f / (sum * sum);
+    }
+
+    std::vector<std::complex<float>> bins(n);
+    Convert::toFloat(tap.format, tap.bytes.data(), bins.data(), n);
+    for (size_t i = 0; i < n; i++)
+        bins[i] *= window[i];
+    fft->forward(bins.data());
+
+    std::unique_lock lock(mutex);
+    if (n != fftSize)
+        return;
+    const bool first = average.size() != n;
+    average.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        // DC in the middle, negative frequencies first
+        const float power = std::norm(bins[(i + n / 2) % n]) * windowGain;
+        average[i] = first ? power : average[i] + AVERAGE * (power - average[i]);
+    }
+}
+
+std::vector<float> SpectrumMonitor::read() {
+    lastReadNs.store(ConnectorStats::nowNs(), std::memory_order_relaxed);
+    std::unique_lock lock(mutex);
+    std::vector<float> dbfs(average.size());
+    for (size_t i = 0; i < average.size(); i++)
+        dbfs[i] = 10 * std::log10(std::max(average[i], 1e-20f));
+    return dbfs;
+}
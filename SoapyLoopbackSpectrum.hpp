@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SoapyLoopbackConvert.hpp"
+#include "SoapyLoopbackThread.hpp"
+
+class Frame;
+
+/** In place radix-2 FFT, tables are built for one power of two size */
+class Fft {
+  public:
+    explicit Fft(size_t size);
+
+    size_t size() const { return n; }
+    void forward(std::complex<float> *data) const;
+
+  private:
+    size_t n;
+    std::vector<uint32_t> reversed;
+    std::vector<std::complex<float>> twiddles;
+};
+
+/**
+ * Averaged power spectrum of a pipe, read with readSetting("spectrum"). The Tx thread
+ * copies consecutive samples of the frames it pushes into a refcounted tap, a background
+ * thread windows, transforms and averages the tap once it is full.
+ *
+ * The monitor is lazy: nothing is tapped unless the spectrum was read within the last
+ * IDLE_AFTER, and while a tap waits for the thread further frames are skipped. The Tx
+ * never blocks on the monitor.
+ */
+class SpectrumMonitor {
+  public:
+    static constexpr long long IDLE_AFTER_NS = 2000000000;  ///< stop tapping this long after the last read
+    static constexpr long long TAP_INTERVAL_NS = 50000000;  ///< at most one tap per interval
+    static constexpr float AVERAGE = 0.25f;                 ///< weight of a new spectrum in the average
+    static constexpr size_t DEFAULT_SIZE = 1024;
+
+    /** The thread runs with the placement of the stream that started the monitor */
+    SpectrumMonitor(size_t size, const ThreadConfig &threads);
+    ~SpectrumMonitor();
+
+    /** Tx side, copies samples of the frame while the monitor is armed */
+    void tap(const Frame &frame);
+
+    /** dBFS per bin, DC in the middle, empty until the first tap was transformed. Arms the monitor */
+    std::vector<float> read();
+
+    /** New FFT size, a power of two, the average restarts */
+    void setSize(size_t size);
+    size_t size() const { return fftSize; }
+
+  private:
+    struct Tap {
+        Convert::Format format {Convert::Format::Unknown};
+        size_t samples {0};
+        std::vector<char> bytes;
+    };
+
+    void run(ThreadConfig threads);
+    void transform(const Tap &tap);
+
+    std::atomic<long long> lastReadNs;
+    std::atomic<size_t> fftSize;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::shared_ptr<Tap> filling;      ///< samples collected by the Tx, under mutex
+    std::shared_ptr<const Tap> ready;  ///< full tap handed to the thread, cleared when done
+    long long nextTapNs {0};
+    bool stopping {false};
+
+    std::vector<float> average;        ///< linear power, under mutex
+
+    // only touched by the thread
+    std::unique_ptr<Fft> fft;
+    std::vector<float> window;
+    float windowGain {1.0f};
+
+    std::thread thread;
+};
@@ -0,0 +1,130 @@
+#include "SoapyLoopbackThread.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <SoapySDR/Logger.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        const std::string item = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.find_first_not_of(" \n") == std::string::npos)
+            continue;
+
+        const size_t dash = item.find('-');
+        const int first = std::stoi(item.substr(0, dash));
+        const int last = (dash == std::string::npos) ? first : std::stoi(item.substr(dash + 1));
+        if (first < 0 || last < first)
+            throw std::runtime_error("invalid CPU list '" + list + "'");
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+ThreadConfig ThreadConfig::fromArgs(const SoapySDR::Kwargs &args) {
+    ThreadConfig config;
+    if (args.count("affinity") > 0)
+        config.cpus = parseCpuList(args.at("affinity"));
+    if (args.count("rt_priority") > 0)
+        config.rtPriority = std::stoi(args.at("rt_priority"));
+    if (args.count("numa_node") > 0)
+        config.numaNode = std::stoi(args.at("numa_node"));
+
+    if (config.rtPriority < 0 || config.rtPriority > 99)
+        throw std::runtime_error("rt_priority must be in range 0..99");
+    if (config.numaNode >= MAX_NUMA_NODES) {
+        SoapySDR_logf(SOAPY_SDR_WARNING, "numa_node %d ignored, must be below %d", config.numaNode, MAX_NUMA_NODES);
+        config.numaNode = -1;
+    }
+    return config;
+}
+
+#ifdef __linux__
+
+static std::vector<int> numaNodeCpus(int node) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!file || !std::getline(file, list)) {
+        SoapySDR_logf(SOAPY_SDR_WARNING, "NUMA node %d not found", node);
+        return {};
+    }
+    return parseCpuList(list);
+}
+
+void applyThreadConfig(const ThreadConfig &config, const std::string &who) {
+    if (config.empty())
+        return;
+
+    std::vector<int> cpus = config.cpus;
+    if (config.numaNode >= 0) {
+        const std::vector<int> nodeCpus = numaNodeCpus(config.numaNode);
+        if (cpus.empty()) {
+            cpus = nodeCpus;
+        } else if (!nodeCpus.empty()) {
+            std::vector<int> both;
+            std::set_intersection(cpus.begin(), cpus.end(), nodeCpus.begin(), nodeCpus.end(), std::back_inserter(both));
+            if (both.empty())
+                SoapySDR_logf(SOAPY_SDR_WARNING, "%s: affinity has no CPU on NUMA node %d, keeping the affinity", who.c_str(), config.numaNode);
+            else
+                cpus = both;
+        }
+
+#ifdef SYS_set_mempolicy
+        // MPOL_PREFERRED, without a libnuma dependency
+        if (config.numaNode < ThreadConfig::MAX_NUMA_NODES) {
+            unsigned long nodemask = 1ul << config.numaNode;
+            if (syscall(SYS_set_mempolicy, 1, &nodemask, ThreadConfig::MAX_NUMA_NODES) != 0)
+                SoapySDR_logf(SOAPY_SDR_WARNING, "%s: set_mempolicy(node %d) failed: %s", who.c_str(), config.numaNode, strerror(errno));
+        }
+#endif
+    }
+
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu: cpus) {
+            if (cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0)
+            SoapySDR_logf(SOAPY_SDR_WARNING, "%s: pthread_setaffinity_np failed: %s", who.c_str(), strerror(err));
+    }
+
+    if (config.rtPriority > 0) {
+        sched_param param {};
+        param.sched_priority = config.rtPriority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0)
+            SoapySDR_logf(SOAPY_SDR_WARNING, "%s: SCHED_FIFO priority %d failed: %s", who.c_str(), config.rtPriority, strerror(err));
+    }
+
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "%s: %zu CPUs, rt priority %d, NUMA node %d", who.c_str(), cpus.size(), config.rtPriority, config.numaNode);
+}
+
+#else
+
+void applyThreadConfig(const ThreadConfig &config, const std::string &who) {
+    if (!config.empty())
+        SoapySDR_logf(SOAPY_SDR_WARNING, "%s: thread affinity and priority are only supported on Linux", who.c_str());
+}
+
+#endif
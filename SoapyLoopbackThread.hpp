@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <SoapySDR/Types.hpp>
+
+/**
+ * Placement of the threads a stream runs on: the caller of activateStream
+ * and the threads the module starts for the pipe of the stream. The module
+ * wide WorkerPool is shared by all streams and placed by dsp_affinity instead.
+ * Parsed from the stream args affinity=<cpu list>, rt_priority=<1..99> and numa_node=<node>.
+ */
+struct ThreadConfig {
+    static constexpr int MAX_NUMA_NODES = 64;  ///< the preferred node goes into one unsigned long nodemask
+
+    std::vector<int> cpus;  ///< allowed CPUs, empty keeps the inherited mask
+    int rtPriority {0};     ///< SCHED_FIFO priority, 0 keeps the current policy
+    int numaNode {-1};      ///< restrict to the CPUs and prefer the memory of this node, -1 for any
+
+    bool empty() const { return cpus.empty() && rtPriority == 0 && numaNode < 0; }
+
+    static ThreadConfig fromArgs(const SoapySDR::Kwargs &args);
+};
+
+/** Parse a Linux style CPU list, e.g. "0-3,8,10-11" */
+std::vector<int> parseCpuList(const std::string &list);
+
+/**
+ * Apply the config to the calling thread, who is only used for logging.
+ * Failures (e.g. missing CAP_SYS_NICE for SCHED_FIFO) are logged and do not throw.
+ */
+void applyThreadConfig(const ThreadConfig &config, const std::string &who);
@@ -0,0 +1,122 @@
+#include "SoapyLoopbackTrace.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <SoapySDR/Logger.hpp>
+
+namespace Trace {
+
+namespace {
+
+/* Single producer ring, the owning thread is the only writer */
+struct ThreadRing {
+    Event events[RING_SIZE];
+    std::atomic<uint64_t> head{0};
+    unsigned tid;
+    bool owned {true};  ///< under ringsMutex, cleared when the owning thread exits
+};
+
+std::mutex ringsMutex;
+std::vector<std::shared_ptr<ThreadRing>> rings;
+unsigned nextTid = 1;
+
+/* Hands the ring back when its thread exits, the next new thread reuses it */
+struct RingOwner {
+    std::shared_ptr<ThreadRing> ring;
+
+    ~RingOwner() {
+        if (ring) {
+            std::unique_lock lock(ringsMutex);
+            ring->owned = false;
+        }
+    }
+};
+
+ThreadRing &threadRing() {
+    thread_local RingOwner owner;
+    if (!owner.ring) {
+        std::unique_lock lock(ringsMutex);
+        for (const auto &ring: rings) {
+            if (!ring->owned) {
+                // the events of the exited thread are dropped, the ring gets a new tid
+                owner.ring = ring;
+                break;
+            }
+        }
+        if (!owner.ring) {
+            owner.ring = std::make_shared<ThreadRing>();
+            rings.push_back(owner.ring);
+        }
+        owner.ring->owned = true;
+        owner.ring->tid = nextTid++;
+        owner.ring->head.store(0, std::memory_order_release);
+    }
+    return *owner.ring;
+}
+
+}
+
+std::atomic<bool> active{false};
+
+void setEnabled(bool enable) {
+#ifndef ENABLE_TRACE
+    if (enable)
+        SoapySDR_log(SOAPY_SDR_WARNING, "Loopback tracing is not compiled in, rebuild with -DENABLE_TRACE=ON");
+#endif
+    active = enable;
+}
+
+uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record(const char *name, uint64_t beginNs, uint64_t endNs) {
+    ThreadRing &ring = threadRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.events[head % RING_SIZE] = {name, beginNs, endNs};
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+bool dump(const std::string &path) {
+    std::ofstream out(path);
+    if (!out) {
+        SoapySDR_logf(SOAPY_SDR_ERROR, "Trace::dump can not open '%s'", path.c_str());
+        return false;
+    }
+
+    // the tid is taken under the lock, a ring is renumbered when a new thread reuses it
+    std::vector<std::pair<std::shared_ptr<ThreadRing>, unsigned>> snapshot;
+    {
+        std::unique_lock lock(ringsMutex);
+        for (const auto &ring: rings)
+            snapshot.emplace_back(ring, ring->tid);
+    }
+
+    // events still being written while dumping may show up torn, the ring is not stopped
+    size_t written = 0;
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    for (const auto &[ring, tid]: snapshot) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+        for (uint64_t i = first; i < head; i++) {
+            const Event &event = ring->events[i % RING_SIZE];
+            out << (written++ ? ",\n" : "\n")
+                << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                << ",\"ts\":" << event.beginNs / 1000.0
+                << ",\"dur\":" << (event.endNs - event.beginNs) / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+
+    SoapySDR_logf(SOAPY_SDR_INFO, "Trace::dump %zu events from %zu threads to '%s'", written, snapshot.size(), path.c_str());
+    return out.good();
+}
+
+}
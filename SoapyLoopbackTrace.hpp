@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "config.h"
+
+/*
+ * Hot path tracing.
+ *
+ * Compiled in with -DENABLE_TRACE=ON and switched on at runtime with
+ * writeSetting("trace", "true"). Every thread records complete events into
+ * its own lock-free ring, writeSetting("trace_dump", path) writes all rings
+ * as Chrome trace JSON (chrome://tracing, ui.perfetto.dev). The ring of an
+ * exited thread is handed to the next thread that starts tracing.
+ */
+namespace Trace {
+
+    constexpr size_t RING_SIZE = 1 << 16;
+
+    struct Event {
+        const char *name;
+        uint64_t beginNs;
+        uint64_t endNs;
+    };
+
+    extern std::atomic<bool> active;
+
+    inline bool enabled() { return active.load(std::memory_order_relaxed); }
+    void setEnabled(bool enable);
+
+    uint64_t nowNs();
+    void record(const char *name, uint64_t beginNs, uint64_t endNs);
+
+    /* Write every recorded event to path, returns false if the file can not be written */
+    bool dump(const std::string &path);
+
+    class Scope {
+      public:
+        explicit Scope(const char *name): name(enabled() ? name : nullptr), begin(this->name ? nowNs() : 0) {}
+        ~Scope() {
+            if (name)
+                record(name, begin, nowNs());
+        }
+
+      private:
+        const char *name;
+        uint64_t begin;
+    };
+}
+
+#ifdef ENABLE_TRACE
+#define LOOPBACK_TRACE_SCOPE(name) Trace::Scope loopbackTraceScope(name)
+#else
+#define LOOPBACK_TRACE_SCOPE(name) do {} while (0)
+#endif
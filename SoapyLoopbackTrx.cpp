@@ -0,0 +1,79 @@
+/*
+ * The MIT License (MIT)
+ * 
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2015-2017 Josh Blum
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "SoapyLoopbackTrx.hpp"
+
+#include <SoapySDR/Logger.hpp>
+
+SoapyLoopbackTrx::SoapyLoopbackTrx(const SoapySDR::Kwargs &args):
+    SoapyLoopback(args),
+    SoapyLoopbackRx(args),
+    SoapyLoopbackTx(args)
+{
+}
+
+SoapyLoopbackTrx::~SoapyLoopbackTrx(void)
+{
+}
+
+/*******************************************************************
+ * Stream API
+ ******************************************************************/
+
+int SoapyLoopbackTrx::activateStream(
+        SoapySDR::Stream *stream,
+        const int flags,
+        const long long timeNs,
+        const size_t numElems)
+{
+    if (stream->direction == SOAPY_SDR_RX)
+        return SoapyLoopbackRx::activateStream(stream, flags, timeNs, numElems);
+    return SoapyLoopbackTx::activateStream(stream, flags, timeNs, numElems);
+}
+
+int SoapyLoopbackTrx::deactivateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs)
+{
+    if (stream->direction == SOAPY_SDR_RX)
+        return SoapyLoopbackRx::deactivateStream(stream, flags, timeNs);
+    return SoapyLoopbackTx::deactivateStream(stream, flags, timeNs);
+}
+
+/*******************************************************************
+ * Antenna API
+ ******************************************************************/
+
+std::vector<std::string> SoapyLoopbackTrx::listAntennas(const int direction, const size_t channel) const
+{
+    if (direction == SOAPY_SDR_RX)
+        return SoapyLoopbackRx::listAntennas(direction, channel);
+    return SoapyLoopbackTx::listAntennas(direction, channel);
+}
+
+std::string SoapyLoopbackTrx::getAntenna(const int direction, const size_t channel) const
+{
+    if (direction == SOAPY_SDR_RX)
+        return SoapyLoopbackRx::getAntenna(direction, channel);
+    return SoapyLoopbackTx::getAntenna(direction, channel);
+}
@@ -0,0 +1,70 @@
+/*
+ * The MIT License (MIT)
+ * 
+ * Copyright (c) 2015 Charles J. Cliffe
+ * Copyright (c) 2015-2017 Josh Blum
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <SoapySDR/Device.hpp>
+
+#include "SoapyLoopbackRx.hpp"
+#include "SoapyLoopbackTx.hpp"
+#include "config.h"
+
+/**
+ * Full duplex transceiver: Rx and Tx streams on the same device, usually on different pipes.
+ * All streaming state lives in the streams, so the Rx and Tx threads never share a lock
+ * beyond the pipes they use. Frequency, sample rate and bandwidth are set per direction.
+ */
+class SoapyLoopbackTrx: public SoapyLoopbackRx, public SoapyLoopbackTx
+{
+public:
+    SoapyLoopbackTrx(const SoapySDR::Kwargs &args);
+
+    ~SoapyLoopbackTrx(void);
+
+    int activateStream(SoapySDR::Stream *stream,
+        const int flags,
+        const long long timeNs,
+        const size_t numElems) override;
+
+    int deactivateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs) override;
+
+    /*******************************************************************
+     * Identification API
+     ******************************************************************/
+    std::string getHardwareKey(void) const override { return "drAK_LoopbackTrx"; }
+
+    /*******************************************************************
+     * Channels API
+     ******************************************************************/
+    bool getFullDuplex(const int direction, const size_t channel) const override { return true; }
+
+    size_t getNumChannels(const int dir) const override { return NUM_CHANNELS; }
+
+    /*******************************************************************
+     * Antenna API
+     ******************************************************************/
+    std::vector<std::string> listAntennas(const int direction, const size_t channel) const override;
+    void setAntenna(const int direction, const size_t channel, const std::string &name) override {};
+    std::string getAntenna(const int direction, const size_t channel) const override;
+};
@@ -35,7 +35,13 @@
 #include <SoapySDR/Formats.hpp>
 #include <SoapySDR/Time.hpp>
 
+#include "SoapyLoopbackIntegrity.hpp"
+#include "SoapyLoopbackMedium.hpp"
+#include "SoapyLoopbackNullSink.hpp"
+#include "SoapyLoopbackScenario.hpp"
 #include "SoapyLoopbackTx.hpp"
+#include "SoapyLoopbackTrace.hpp"
+#include "SoapyLoopbackWorkers.hpp"
 
 using namespace std::chrono_literals;
 
@@ -71,9 +77,11 @@ int SoapyLoopbackTx::writeStream(
     void *buff;
     int capacity = numElems;
     capacity = acquireWriteBuffer(stream, handle, &buff, timeoutUs);
+    if (capacity <= 0)
+        return capacity;
     int result = std::min<int>(capacity, numElems);
     memcpy(buff, *buffs, result * stream->itemSize);
-    releaseWriteBuffer(stream, handle, numElems, flags, timeNs);
+    releaseWriteBuffer(stream, handle, result, flags, timeNs);
     //SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopbackTx::writeStream DONE");
     return result;
 }
@@ -88,22 +96,44 @@ int SoapyLoopbackTx::acquireWriteBuffer(
     void **buffs,
     const long timeoutUs)
 {
-    //SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopbackTx::acquireWriteBuffer");
-    do {
-        buffer.aquired.frame = std::move(stream->pipe->pullEmpty(static_cast<std::chrono::microseconds>(timeoutUs)));
-//        SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopbackTx::acquireWriteBuffer frame");
+    LOOPBACK_TRACE_SCOPE("SoapyLoopbackTx::acquireWriteBuffer");
+    if (stream->nullSink) {
+        stream->aquired.frame = std::move(stream->nullSink->frame);
+        stream->aquired.currentBuff = stream->aquired.frame->payload();
+        buffs[0] = stream->aquired.currentBuff;
+        return stream->aquired.frame->size() / stream->itemSize;
+    }
+    if (stream->medium) {
+        stream->aquired.frame = std::move(stream->localFrame);
+        stream->aquired.currentBuff = stream->aquired.frame->payload();
+        buffs[0] = stream->aquired.currentBuff;
+        return stream->aquired.frame->size() / stream->itemSize;
     }
-    while (!buffer.aquired.frame && stream->pipe->isActive());
+
+    //SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopbackTx::acquireWriteBuffer");
+    stream->aquired.frame = stream->pipe->pullEmpty(pipeTimeout(timeoutUs), stream->wait);
     if (!stream->pipe->isActive()) {
-        buffer.aquired.currentBuff = nullptr;
-        buffer.aquired.bufferedElems = 0;
+        if (stream->aquired.frame)
+            stream->pipe->pushEmpty(std::move(stream->aquired.frame));
+        stream->aquired.currentBuff = nullptr;
+        stream->aquired.bufferedElems = 0;
         return 0;
     }
+    if (!stream->aquired.frame && stream->backPressure == BackPressure::DropNewest) {
+        // the Rx is behind, these samples go to the discard frame
+        stream->aquired.frame = std::move(stream->localFrame);
+        stream->discarding = true;
+    }
+    if (!stream->aquired.frame) {
+        stream->aquired.currentBuff = nullptr;
+        stream->aquired.bufferedElems = 0;
+        return SOAPY_SDR_TIMEOUT;
+    }
 
-    buffer.aquired.currentBuff = (char *) buffer.aquired.frame->data.data();
-    buffs[0] = buffer.aquired.currentBuff;
+    stream->aquired.currentBuff = stream->aquired.frame->payload();
+    buffs[0] = stream->aquired.currentBuff;
     //SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopbackTx::acquireWriteBuffer DONE");
-    return buffer.aquired.frame->data.size() / stream->itemSize;
+    return stream->aquired.frame->size() / stream->itemSize;
 }
 
 void SoapyLoopbackTx::releaseWriteBuffer(
@@ -113,11 +143,75 @@ void SoapyLoopbackTx::releaseWriteBuffer(
     int &flags,
     const long long timeNs) 
 {
+    LOOPBACK_TRACE_SCOPE("SoapyLoopbackTx::releaseWriteBuffer");
+    //a timed burst starts at its own tick, otherwise the samples follow the previous ones
+    const double rate = tuningOf(SOAPY_SDR_TX).sampleRate;
+    const long long tick = (flags & SOAPY_SDR_HAS_TIME) ? SoapySDR::timeNsToTicks(timeNs, rate) : stream->ticks;
+    stream->ticks = tick + numElems;
+    if (simTime)
+        advanceTicks(SOAPY_SDR_TX, stream->ticks);
+    applyScenario(stream, numElems, tick, rate);
+
+    if (stream->nullSink) {
+        stream->nullSink->consume(stream->aquired.frame->payload(), numElems);
+        stream->nullSink->frame = std::move(stream->aquired.frame);
+        stream->aquired.currentBuff = nullptr;
+        stream->aquired.bufferedElems = 0;
+        return;
+    }
+    if (stream->medium) {
+        stream->medium->transmit(*stream->mediumPort, stream->aquired.frame->payload(), numElems);
+        stream->localFrame = std::move(stream->aquired.frame);
+        stream->aquired.currentBuff = nullptr;
+        stream->aquired.bufferedElems = 0;
+        return;
+    }
+
+    if (stream->discarding) {
+        // the sequence moves on so an integrity checking Rx counts the frame as lost
+        stream->pipe->recordDrop(numElems * stream->itemSize);
+        stream->sequence++;
+        stream->localFrame = std::move(stream->aquired.frame);
+        stream->discarding = false;
+        stream->aquired.currentBuff = nullptr;
+        stream->aquired.bufferedElems = 0;
+        return;
+    }
+
     //SoapySDR_log(SOAPY_SDR_INFO, "SoapyLoopbackTx::releaseWriteBuffer");
-    buffer.aquired.frame->data.resize(numElems * stream->itemSize);
-    stream->pipe->pushData(std::move(buffer.aquired.frame));
-    buffer.aquired.currentBuff = nullptr;
-    buffer.aquired.bufferedElems = 0;
+    stream->aquired.frame->resize(numElems * stream->itemSize);
+    FrameHeader &header = stream->aquired.frame->header();
+    header.format = static_cast<uint8_t>(stream->formatId);
+    header.channels = 1;
+    header.tick = tick;
+    header.flags = 0;
+    if (flags & SOAPY_SDR_HAS_TIME)
+        header.flags |= FrameHeader::HAS_TIME;
+    if (flags & SOAPY_SDR_END_BURST)
+        header.flags |= FrameHeader::END_BURST;
+    if (stream->stage) {
+        // the sequence is taken in submission order, the CRC is computed on a worker
+        header.sequence = stream->sequence++;
+        stream->stage->submit(std::move(stream->aquired.frame));
+    } else if (stream->integrity)
+        Integrity::stamp(*stream->aquired.frame, stream->sequence++);
+    if (stream->aquired.frame)
+        stream->pipe->pushData(std::move(stream->aquired.frame));
+    stream->aquired.currentBuff = nullptr;
+    stream->aquired.bufferedElems = 0;
+}
+
+void SoapyLoopbackTx::applyScenario(SoapySDR::Stream *stream, const size_t numElems, const long long tick, const double rate)
+{
+    const uint64_t version = scenarioVersion.load(std::memory_order_acquire);
+    if (version != stream->scenarioVersion) {
+        // a new scenario starts from its first event, the one in effect is dropped
+        std::unique_lock lock(scenarioMutex);
+        stream->scenario = scenario ? std::make_unique<ScenarioPlayer>(scenario) : nullptr;
+        stream->scenarioVersion = scenarioVersion;
+    }
+    if (stream->scenario)
+        stream->scenario->process(stream->formatId, stream->aquired.frame->payload(), numElems, tick, rate);
 }
 
 int SoapyLoopbackTx::activateStream(
@@ -129,9 +223,39 @@ int SoapyLoopbackTx::activateStream(
     //if (flags != 0) return SOAPY_SDR_NOT_SUPPORTED;
     SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyLoopbackTx::activateStream. Using connector %s", stream->pipeName.c_str());
 
+    applyThreadConfig(stream->threads, "SoapyLoopbackTx::activateStream");
+    stream->ticks = currentTicks(SOAPY_SDR_TX);
+    if (stream->pipeName == NullSink::PIPE_NAME) {
+        stream->nullSink = std::make_unique<NullSink>(stream->format, stream->itemSize, stream->bufferSize, stream->args);
+        return numElems;
+    }
+    if (Medium::isMediumPipe(stream->pipeName)) {
+        if (!stream->localFrame)
+            stream->localFrame = std::make_unique<Frame>(stream->bufferSize - stream->bufferSize % stream->itemSize);
+        if (!stream->mediumPort)
+            stream->mediumPort = std::make_shared<MediumPort>(SOAPY_SDR_TX, stream->format, stream->itemSize);
+        stream->mediumPort->tune(tuningOf(SOAPY_SDR_TX).centerFrequency, tuningOf(SOAPY_SDR_TX).sampleRate, getBandwidth(SOAPY_SDR_TX, 0));
+        stream->medium = Medium::getMedium(stream->pipeName);
+        stream->medium->attach(stream->mediumPort);
+        return numElems;
+    }
+
+    stream->sequence = 0;
     stream->pipe = Connector::getConnector(stream->pipeName);
-    stream->pipe->FillEmpty(stream->noOfBuffers, stream->bufferSize);
+    stream->pipe->FillEmpty(stream->noOfBuffers, stream->bufferSize, stream->poolMemory);
+    stream->pipe->setBackPressure(stream->backPressure, stream->growMax);
+    if (stream->backPressure == BackPressure::DropNewest && !stream->localFrame)
+        stream->localFrame = std::make_unique<Frame>(stream->bufferSize);
     stream->pipe->activate();
+    if (stream->args.count("dsp_pool") > 0 && stream->args.at("dsp_pool") == "true") {
+        // integrity stamping is the only stage work, without it the pool would only add a hop per frame
+        if (!stream->integrity)
+            SoapySDR_log(SOAPY_SDR_WARNING, "SoapyLoopbackTx: dsp_pool=true has no work without integrity=true, frames go to the pipe directly");
+        else
+            stream->stage = std::make_unique<OrderedStage>(
+                [](Frame &frame) { Integrity::stamp(frame, frame.header().sequence); },
+                [pipe = stream->pipe](std::unique_ptr<Frame> &&frame) { pipe->pushData(std::move(frame)); });
+    }
     return numElems;
 }
 
@@ -143,6 +267,19 @@ int SoapyLoopbackTx::deactivateStream(SoapySDR::Stream *stream, const int flags,
         SoapySDR_logf(SOAPY_SDR_ERROR, "SoapyLoopbackTx::deactivateStream %x flats not supported", flags);
         return SOAPY_SDR_NOT_SUPPORTED;
     }
+    if (stream->nullSink) {
+        SoapySDR_logf(SOAPY_SDR_INFO, "SoapyLoopbackTx null sink: %f Msps", stream->nullSink->stats.pushedMsps(stream->itemSize));
+        return 0;
+    }
+    if (stream->medium) {
+        stream->medium->detach(stream->mediumPort);
+        return 0;
+    }
+
+    if (stream->stage) {
+        // frames still on the workers reach the pipe before the Rx is told to stop
+        stream->stage.reset();
+    }
     stream->pipe->notiffyExit();
     return 0;
 }
\ No newline at end of file
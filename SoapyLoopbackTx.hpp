@@ -37,7 +37,7 @@
 #include "SoapyLoopback.hpp"
 #include "config.h"
 
-class SoapyLoopbackTx: public SoapyLoopback
+class SoapyLoopbackTx: public virtual SoapyLoopback
 {
 public:
     SoapyLoopbackTx(const SoapySDR::Kwargs &args);
@@ -91,4 +91,7 @@ public:
 
 private:
     void tx_prepare_empty_buffer(void);
+
+    /** Run the acquired samples through the device scenario, the first one is at tick of rate */
+    void applyScenario(SoapySDR::Stream *stream, const size_t numElems, const long long tick, const double rate);
 };
@@ -0,0 +1,195 @@
+#include "SoapyLoopbackWorkers.hpp"
+
+#include <algorithm>
+
+#include <SoapySDR/Logger.hpp>
+
+#include "SoapyLoopbackConnector.hpp"
+
+/*******************************************************************
+ * WorkerPool
+ ******************************************************************/
+
+WorkerPool &WorkerPool::instance() {
+    // never destroyed, streams may still submit work during static destruction
+    static WorkerPool *pool = new WorkerPool;
+    return *pool;
+}
+
+void WorkerPool::configure(size_t threads, const ThreadConfig &config) {
+    std::unique_lock lock(configMutex);
+    stopLocked();
+    startLocked(threads, config);
+}
+
+size_t WorkerPool::size() const {
+    std::shared_lock lock(configMutex);
+    return workers.size();
+}
+
+void WorkerPool::startLocked(size_t threads, const ThreadConfig &config) {
+    threads = std::max<size_t>(threads, 1);
+    SoapySDR_logf(SOAPY_SDR_DEBUG, "WorkerPool starting %zu workers", threads);
+
+    for (size_t i = 0; i < threads; i++)
+        workers.push_back(std::make_unique<Worker>());
+
+    for (size_t i = 0; i < threads; i++) {
+        ThreadConfig placement = config;
+        if (!config.cpus.empty())
+            placement.cpus = {config.cpus[i % config.cpus.size()]};
+        workers[i]->thread = std::thread([this, i, placement]() {
+            if (!placement.empty())
+                applyThreadConfig(placement, "WorkerPool worker " + std::to_string(i));
+            run(i);
+        });
+    }
+}
+
+void WorkerPool::stopLocked() {
+    {
+        std::unique_lock lock(idleMutex);
+        stopping = true;
+    }
+    idleCond.notify_all();
+    for (auto &worker : workers)
+        worker->thread.join();
+    workers.clear();
+    stopping = false;
+}
+
+void WorkerPool::submit(Job &&job) {
+    std::shared_lock lock(configMutex);
+    if (workers.empty()) {
+        lock.unlock();
+        {
+            std::unique_lock startLock(configMutex);
+            if (workers.empty())
+                startLocked(std::max(std::thread::hardware_concurrency(), 2u) - 1, ThreadConfig{});
+        }
+        lock.lock();
+    }
+
+    Worker &worker = *workers[nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+    {
+        std::unique_lock workerLock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+    }
+    pending.fetch_add(1, std::memory_order_release);
+    {
+        // taking the lock orders the notify after a worker checked pending and went to sleep
+        std::unique_lock idleLock(idleMutex);
+    }
+    idleCond.notify_one();
+}
+
+bool WorkerPool::popLocal(size_t index, Job &job) {
+    Worker &worker = *workers[index];
+    std::unique_lock lock(worker.mutex);
+    if (worker.jobs.empty())
+        return false;
+    job = std::move(worker.jobs.back());
+    worker.jobs.pop_back();
+    return true;
+}
+
+bool WorkerPool::steal(size_t index, Job &job) {
+    auto takeOldest = [&](Worker &victim) {
+        if (victim.jobs.empty())
+            return false;
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        stolen.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    };
+
+    Worker *contended = nullptr;
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker &victim = *workers[(index + i) % workers.size()];
+        std::unique_lock lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            contended = &victim;
+            continue;
+        }
+        if (takeOldest(victim))
+            return true;
+    }
+    if (contended) {
+        // lost every try_lock race, wait for the last busy victim instead of polling again
+        std::unique_lock lock(contended->mutex);
+        return takeOldest(*contended);
+    }
+    return false;
+}
+
+void WorkerPool::run(size_t index) {
+    Job job;
+    for (;;) {
+        if (popLocal(index, job) || steal(index, job)) {
+            pending.fetch_sub(1, std::memory_order_relaxed);
+            job();
+            job = nullptr;
+            continue;
+        }
+
+        if (pending.load(std::memory_order_acquire) > 0) {
+            // a job is counted but being pushed or taken right now, the idle wait would not block
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock lock(idleMutex);
+        // queued jobs are finished before the workers exit
+        idleCond.wait(lock, [&]() { return pending.load(std::memory_order_acquire) > 0 || stopping; });
+        if (stopping && pending.load(std::memory_order_acquire) == 0)
+            return;
+    }
+}
+
+/*******************************************************************
+ * OrderedStage
+ ******************************************************************/
+
+OrderedStage::OrderedStage(Work work, Sink sink): work(std::move(work)), sink(std::move(sink)) {
+}
+
+OrderedStage::~OrderedStage() {
+    drain();
+}
+
+void OrderedStage::submit(std::unique_ptr<Frame> &&frame) {
+    const uint64_t sequence = nextIn++;
+    {
+        std::unique_lock lock(mutex);
+        submitted++;
+    }
+    // std::function needs a copyable callable, the job owns the frame until it completes
+    Frame *raw = frame.release();
+    WorkerPool::instance().submit([this, sequence, raw]() {
+        std::unique_ptr<Frame> owned(raw);
+        work(*owned);
+        complete(sequence, std::move(owned));
+    });
+}
+
+void OrderedStage::complete(uint64_t sequence, std::unique_ptr<Frame> &&frame) {
+    std::unique_lock lock(mutex);
+    ready.emplace(sequence, std::move(frame));
+    while (!ready.empty() && ready.begin()->first == nextOut) {
+        auto node = ready.extract(ready.begin());
+        sink(std::move(node.mapped()));
+        nextOut++;
+    }
+    if (nextOut == submitted)
+        drained.notify_all();
+}
+
+void OrderedStage::drain() {
+    std::unique_lock lock(mutex);
+    drained.wait(lock, [&]() { return nextOut == submitted; });
+}
+
+size_t OrderedStage::inFlight() const {
+    std::unique_lock lock(mutex);
+    return submitted - nextOut;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "SoapyLoopbackThread.hpp"
+
+class Frame;
+
+/**
+ * Module wide pool of DSP worker threads. Every worker owns a deque, runs its own jobs
+ * newest first and steals the oldest job of another worker when it runs dry. External
+ * submissions are spread round robin over the deques.
+ *
+ * The pool starts on first use with one worker per hardware thread minus one, the
+ * settings dsp_threads and dsp_affinity resize and place it. Worker i is pinned to
+ * cpus[i % cpus.size()] when an affinity is given.
+ */
+class WorkerPool {
+  public:
+    using Job = std::function<void()>;
+
+    static WorkerPool &instance();
+
+    /** Restart the workers, jobs already queued still run */
+    void configure(size_t threads, const ThreadConfig &config);
+
+    void submit(Job &&job);
+
+    size_t size() const;
+    uint64_t steals() const { return stolen.load(std::memory_order_relaxed); }
+
+  private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+
+    WorkerPool() = default;
+    void startLocked(size_t threads, const ThreadConfig &config);
+    void stopLocked();
+    void run(size_t index);
+    bool popLocal(size_t index, Job &job);
+    bool steal(size_t index, Job &job);
+
+    mutable std::shared_mutex configMutex;  ///< shared by submitters, exclusive while resizing
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> nextWorker {0};
+    std::atomic<uint64_t> stolen {0};
+
+    std::mutex idleMutex;
+    std::condition_variable idleCond;
+    std::atomic<size_t> pending {0};
+    bool stopping {false};
+};
+
+/**
+ * Sequence numbered stage of a pipe: frames are processed in parallel on the worker pool
+ * and handed to the sink in submission order. The worker finishing the oldest outstanding
+ * frame drains every frame that became ready behind it.
+ */
+class OrderedStage {
+  public:
+    using Work = std::function<void(Frame &)>;
+    using Sink = std::function<void(std::unique_ptr<Frame> &&)>;
+
+    OrderedStage(Work work, Sink sink);
+    ~OrderedStage();
+
+    void submit(std::unique_ptr<Frame> &&frame);
+
+    /** Wait until every submitted frame reached the sink */
+    void drain();
+
+    size_t inFlight() const;
+
+  private:
+    void complete(uint64_t sequence, std::unique_ptr<Frame> &&frame);
+
+    Work work;
+    Sink sink;
+
+    uint64_t nextIn {0};   ///< only touched by the submitting thread
+
+    mutable std::mutex mutex;
+    std::condition_variable drained;
+    std::map<uint64_t, std::unique_ptr<Frame>> ready;
+    uint64_t nextOut {0};
+    uint64_t submitted {0};
+};
@@ -0,0 +1,97 @@
+/*
+ * Throughput and compression ratio of the IQ codec.
+ *
+ *   loopback_bench_codec [frames] [frame_bytes]
+ *
+ * Codes bursty CS16 frames, a noisy tone at about 10 effective bits half of the time and
+ * silence in between, once on the calling thread and once as a batch on the WorkerPool.
+ * Msps per core is the sample rate one thread sustains.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <SoapySDR/Formats.hpp>
+
+#include "SoapyLoopbackCodec.hpp"
+#include "SoapyLoopbackWorkers.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point begin) {
+    return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+static void fillBursty(std::vector<int16_t> &iq, std::mt19937 &rng) {
+    std::normal_distribution<double> noise(0.0, 4.0);
+    const size_t samples = iq.size() / 2;
+    const size_t burst = samples / 4;
+    for (size_t n = 0; n < samples; n++) {
+        const bool on = (n / burst) % 2 == 0;
+        const double amplitude = on ? 500.0 : 0.0;
+        iq[2 * n] = static_cast<int16_t>(std::lround(amplitude * std::cos(0.05 * n) + (on ? noise(rng) : 0.0)));
+        iq[2 * n + 1] = static_cast<int16_t>(std::lround(amplitude * std::sin(0.05 * n) + (on ? noise(rng) : 0.0)));
+    }
+}
+
+int main(int argc, char **argv) {
+    const size_t frames = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+    const size_t frameBytes = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16 * 32 * 512;
+    const double msamples = frames * (frameBytes / 4) / 1e6;
+
+    std::mt19937 rng(1);
+    std::vector<std::vector<int16_t>> raw(frames, std::vector<int16_t>(frameBytes / 2));
+    for (auto &frame : raw)
+        fillBursty(frame, rng);
+
+    // one core
+    std::vector<uint8_t> coded(IqCodec::maxEncodedSize(frameBytes));
+    std::vector<int16_t> decoded(frameBytes / 2);
+    size_t codedTotal = 0;
+    double encodeSeconds = 0, decodeSeconds = 0;
+    bool lossless = true;
+    for (const auto &frame : raw) {
+        auto begin = Clock::now();
+        const size_t bytes = IqCodec::encode(SOAPY_SDR_CS16, frame.data(), frameBytes, coded.data());
+        encodeSeconds += seconds(begin);
+        begin = Clock::now();
+        const size_t out = IqCodec::decode(coded.data(), bytes, decoded.data(), frameBytes);
+        decodeSeconds += seconds(begin);
+        codedTotal += bytes;
+        lossless = lossless && out == frameBytes && std::memcmp(decoded.data(), frame.data(), frameBytes) == 0;
+    }
+    printf("ratio %.2f, %s\n", double(frames * frameBytes) / codedTotal, lossless ? "lossless" : "MISMATCH");
+    printf("1 thread:  encode %.0f Msps/core, decode %.0f Msps/core\n", msamples / encodeSeconds, msamples / decodeSeconds);
+
+    // worker pool
+    std::vector<IqCodec::Block> blocks(frames);
+    std::vector<std::vector<int16_t>> output(frames, std::vector<int16_t>(frameBytes / 2));
+    for (size_t i = 0; i < frames; i++) {
+        blocks[i].raw = raw[i].data();
+        blocks[i].rawBytes = frameBytes;
+    }
+
+    auto begin = Clock::now();
+    IqCodec::encodeBatch(SOAPY_SDR_CS16, blocks);
+    encodeSeconds = seconds(begin);
+
+    for (size_t i = 0; i < frames; i++)
+        blocks[i].raw = output[i].data();
+    begin = Clock::now();
+    lossless = IqCodec::decodeBatch(blocks);
+    decodeSeconds = seconds(begin);
+    for (size_t i = 0; i < frames; i++)
+        lossless = lossless && output[i] == raw[i];
+
+    // the pool starts with the first batch
+    const size_t cores = WorkerPool::instance().size();
+    printf("%zu workers: encode %.0f Msps (%.0f Msps/core), decode %.0f Msps (%.0f Msps/core), %s\n", cores,
+        msamples / encodeSeconds, msamples / encodeSeconds / cores,
+        msamples / decodeSeconds, msamples / decodeSeconds / cores, lossless ? "lossless" : "MISMATCH");
+    return lossless ? EXIT_SUCCESS : EXIT_FAILURE;
+}
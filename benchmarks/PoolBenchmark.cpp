@@ -0,0 +1,75 @@
+/*
+ * Startup cost of the pipe frame pools.
+ *
+ *   loopback_bench_pool [pipes]
+ *
+ * Sets up one CS16 Tx stream per pipe with the default 15 frames of 256 KiB and measures,
+ * with prefault=false and prefault=true: the time activateStream takes, pool_prefault_us,
+ * the first pass of writes through every frame and the worst single write. A second
+ * activation reuses the pools and shows what a restart costs.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <SoapySDR/Formats.hpp>
+
+#include "SoapyLoopbackTx.hpp"
+#include "config.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double millis(Clock::time_point begin, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+static void run(const std::string &prefault, const size_t pipes) {
+    SoapyLoopbackTx tx(SoapySDR::Kwargs{});
+    std::vector<SoapySDR::Stream *> streams;
+    for (size_t p = 0; p < pipes; p++) {
+        streams.push_back(tx.setupStream(SOAPY_SDR_TX, SOAPY_SDR_CS16, {0},
+            {{"pipe", "bench_pool_" + prefault + "_" + std::to_string(p)}, {"prefault", prefault}}));
+    }
+
+    const size_t frameElems = DEFAULT_BUFFER_LENGTH / 4;
+    std::vector<int16_t> samples(2 * frameElems, 1);
+    for (int activation = 1; activation <= 2; activation++) {
+        const auto begin = Clock::now();
+        for (auto *stream : streams)
+            tx.activateStream(stream, 0, 0, 0);
+        const auto activated = Clock::now();
+
+        double worstUs = 0;
+        for (int frame = 0; frame < DEFAULT_NUM_BUFFERS; frame++) {
+            for (auto *stream : streams) {
+                const auto writeBegin = Clock::now();
+                const void *buffs[] = {samples.data()};
+                int flags = 0;
+                tx.writeStream(stream, buffs, frameElems, flags, 0, 100000);
+                worstUs = std::max(worstUs, 1e3 * millis(writeBegin, Clock::now()));
+            }
+        }
+        const auto passed = Clock::now();
+
+        printf("prefault=%-5s activation %d: activate %7.1f ms, pool_prefault_us %6s per pipe, first pass %7.1f ms, worst write %6.0f us\n",
+            prefault.c_str(), activation, millis(begin, activated), tx.readSetting("pool_prefault_us@" + streams[0]->pipeName).c_str(),
+            millis(activated, passed), worstUs);
+
+        for (auto *stream : streams)
+            tx.deactivateStream(stream, 0, 0);
+    }
+    for (auto *stream : streams)
+        tx.closeStream(stream);
+}
+
+int main(int argc, char **argv) {
+    const size_t pipes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100;
+    printf("%zu pipes of %d x %d byte frames\n", pipes, DEFAULT_NUM_BUFFERS, DEFAULT_BUFFER_LENGTH);
+    run("false", pipes);
+    run("true", pipes);
+    return EXIT_SUCCESS;
+}